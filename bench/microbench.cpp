@@ -0,0 +1,246 @@
+using namespace ::std;
+
+#include "es_server.hpp"
+#include "protocol.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ftw.h>
+#include <unistd.h>
+
+using BenchClock = chrono::steady_clock;
+
+// Table sizes of the populated server
+static const int BENCH_USERS        = 100000;
+static const int BENCH_EVENTS       = 998;  // allocate_eid scans to EID 999
+static const int BENCH_RESERVATIONS = 50000;
+static const int HEAVY_RESERVATIONS = 100;  // of the user LMR is timed for
+static const char BENCH_PASSWORD[]  = "bench123";
+
+// Shortest repetition: the iteration count doubles until one takes this long
+static const double MIN_REPETITION_NS = 50e6;
+
+// Results are added here so the timed work cannot be optimized away
+static volatile size_t sink;
+
+struct BenchResult {
+    string   name;
+    uint64_t iterations;    // per repetition
+    double   ns_per_op;     // median over the repetitions
+    double   min_ns_per_op;
+};
+
+// Time fn, one operation per call, over reps repetitions
+template <typename F>
+static BenchResult measure(const string& name, int reps, F&& fn) {
+    auto run = [&](uint64_t n) {
+        size_t acc   = 0;
+        auto   start = BenchClock::now();
+        for (uint64_t i = 0; i < n; ++i) acc += fn();
+        double ns = chrono::duration<double, nano>(BenchClock::now() - start).count();
+        sink = sink + acc;
+        return ns;
+    };
+    uint64_t n = 1;
+    while (run(n) < MIN_REPETITION_NS) n *= 2;
+
+    vector<double> per_op;
+    for (int r = 0; r < reps; ++r) per_op.push_back(run(n) / static_cast<double>(n));
+    sort(per_op.begin(), per_op.end());
+    return {name, n, per_op[per_op.size() / 2], per_op.front()};
+}
+
+// Friend of EventServer: fills its tables directly, then times its
+// private helpers on them
+class ServerBench {
+public:
+    explicit ServerBench(EventServer& s) : s_(s) {}
+
+    void populate();
+    void run(int reps, const string& filter, vector<BenchResult>& results);
+
+private:
+    EventServer&   s_;
+    vector<string> uids_;
+    vector<string> eids_;
+};
+
+void ServerBench::populate() {
+    for (int i = 0; i < BENCH_USERS; ++i) {
+        string uid = to_string(100000 + i);
+        s_.users_.insert(uid, User{uid, BENCH_PASSWORD, true});
+        uids_.push_back(uid);
+    }
+
+    // A mix of open, sold-out and closed events, owned by the first users
+    for (int i = 1; i <= BENCH_EVENTS; ++i) {
+        char eid[4];
+        snprintf(eid, sizeof(eid), "%03d", i);
+        Event ev;
+        ev.eid        = eid;
+        ev.owner_uid  = uids_[static_cast<size_t>(i) % 100];
+        ev.name       = "event" + to_string(i);
+        ev.date       = "01-01-2099";
+        ev.time       = "20:00";
+        ev.attendance = 500;
+        ev.reserved   = i % 7 == 0 ? 500 : i % 100;
+        ev.closed     = i % 11 == 0;
+        ev.fname      = "flyer.txt";
+        ev.fsize      = 1000;
+        s_.restore_event(move(ev));
+        eids_.push_back(eid);
+    }
+
+    // uids_[0] holds HEAVY_RESERVATIONS; the rest are spread at random
+    mt19937 rng(42);
+    uniform_int_distribution<size_t> user(1, uids_.size() - 1);
+    uniform_int_distribution<size_t> event(0, eids_.size() - 1);
+    for (int i = 0; i < BENCH_RESERVATIONS; ++i) {
+        const string& uid = i < HEAVY_RESERVATIONS ? uids_[0] : uids_[user(rng)];
+        s_.add_reservation({uid, eids_[event(rng)], 1 + i % 5, "17-10-2026 12:00:00"});
+    }
+}
+
+void ServerBench::run(int reps, const string& filter, vector<BenchResult>& results) {
+    auto bench = [&](const string& name, auto&& fn) {
+        if (name.find(filter) == string::npos) return;
+        results.push_back(measure(name, reps, fn));
+    };
+
+    // Keys looked up in a shuffled order, so lookups miss the cache as
+    // they would under load
+    mt19937 rng(7);
+    vector<string> user_keys(uids_);
+    shuffle(user_keys.begin(), user_keys.end(), rng);
+    vector<string> event_keys(eids_);
+    shuffle(event_keys.begin(), event_keys.end(), rng);
+    vector<const Event*> events;
+    for (const auto& eid : event_keys) events.push_back(s_.find_event(eid));
+
+    size_t i = 0;
+    auto next = [&i](size_t n) { i = i + 1 < n ? i + 1 : 0; return i; };
+
+    // The TCP header lexer on a whole CRE header
+    Connection c;
+    c.in = "CRE 100001 bench123 party 01-01-2099 20:00 500 flyer.txt 1000 ";
+    bench("EventServer::next_token(CRE header)", [&] {
+        c.in_pos = c.scan_pos = 0;
+        string_view tok;
+        size_t n = 0;
+        while (s_.next_token(c, tok)) n += tok.size();
+        return n;
+    });
+
+    bench("EventServer::compute_event_state", [&] {
+        return static_cast<size_t>(s_.compute_event_state(*events[next(events.size())]));
+    });
+
+    const char* dates[] = {"01-01-2099", "31-12-2026", "15-06-2030", "29-02-2028"};
+    const char* times[] = {"20:00", "23:59", "08:30:00", "12:00"};
+    bench("EventServer::valid_event_date+time", [&] {
+        size_t k = next(4);
+        return static_cast<size_t>(s_.valid_event_date(dates[k]) +
+                                   s_.valid_event_time(times[k]));
+    });
+
+    bench("EventServer::allocate_eid", [&] {
+        return s_.allocate_eid().size();
+    });
+
+    bench("EventServer::find_user", [&] {
+        return static_cast<size_t>(s_.find_user(user_keys[next(user_keys.size())]) != nullptr);
+    });
+
+    bench("EventServer::find_event", [&] {
+        return static_cast<size_t>(s_.find_event(event_keys[next(event_keys.size())]) != nullptr);
+    });
+
+    bench("EventServer::build_lst_reply", [&] {
+        return s_.build_lst_reply().size();
+    });
+
+    vector<EventServer::ListItem> items;
+    bench("EventServer::my_reservations(" + to_string(HEAVY_RESERVATIONS) + ")", [&] {
+        items.clear();
+        s_.my_reservations(uids_[0], BENCH_PASSWORD, "", items);
+        return items.size();
+    });
+
+    string lst = s_.build_lst_reply();
+    bench("protocol::parse_reply(RLS)", [&] {
+        auto r = protocol::parse_reply(lst);
+        string_view rec[5];
+        size_t n = 0;
+        while (r.next(rec)) ++n;
+        return n;
+    });
+
+    string req;
+    bench("protocol::append_create_header", [&] {
+        req.clear();
+        protocol::append_create_header(req, "100001", BENCH_PASSWORD, "party",
+                                       "01-01-2099", "20:00", 500, "flyer.txt", 1000);
+        return req.size();
+    });
+}
+
+static int remove_entry(const char* path, const struct stat*, int, struct FTW*) {
+    return ::remove(path);
+}
+
+int main(int argc, char* argv[]) {
+    int    reps = 5;
+    string filter;
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-r" && i + 1 < argc) {
+            reps = max(1, atoi(argv[++i]));
+        } else if (arg == "-f" && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [-r repetitions] [-f name_filter]\n";
+            return 1;
+        }
+    }
+
+    // The server keeps its data/ in a scratch directory
+    char dir[] = "/tmp/es-microbench-XXXXXX";
+    if (!::mkdtemp(dir) || ::chdir(dir) != 0) {
+        perror("[microbench] scratch directory");
+        return 1;
+    }
+
+    vector<BenchResult> results;
+    {
+        ServerOptions opts;
+        opts.file_cache_mb = 0;
+        EventServer server(opts);
+        ServerBench bench(server);
+        bench.populate();
+        bench.run(reps, filter, results);
+    }
+    ::nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    // JSON, one benchmark per line so runs diff cleanly
+    printf("{\n  \"users\": %d,\n  \"events\": %d,\n  \"reservations\": %d,\n"
+           "  \"repetitions\": %d,\n  \"benchmarks\": [\n",
+           BENCH_USERS, BENCH_EVENTS, BENCH_RESERVATIONS, reps);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        printf("    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, "
+               "\"min_ns_per_op\": %.2f}%s\n",
+               r.name.c_str(), static_cast<unsigned long long>(r.iterations),
+               r.ns_per_op, r.min_ns_per_op, i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
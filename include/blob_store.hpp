@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+// Content-addressed store for event description files: each blob is
+// <dir>/<sha256-hex> of its bytes, so identical uploads share one file.
+// References (events using a blob) are counted so unreferenced blobs can
+// be swept. Only hash_file and store are thread-safe; the rest is called
+// under events_mtx_.
+class BlobStore {
+public:
+    explicit BlobStore(std::string dir);
+
+    // Hex SHA-256 of a file's contents ("" if it cannot be read)
+    static std::string hash_file(const std::string& path);
+
+    // Move a finished upload with the given hash into the store, or drop
+    // it if that blob is already stored. With durable, the file and the
+    // new directory entry are synced first. The blob is unreferenced
+    // (and swept at the next start) until add_ref.
+    bool store(const std::string& tmp_path, const std::string& key, bool durable);
+
+    void add_ref(const std::string& key);
+    void clear_refs();
+
+    // Remove stored blobs nobody references; returns how many
+    size_t sweep();
+
+    std::string path(const std::string& key) const;
+
+private:
+    std::string                             dir_;
+    std::unordered_map<std::string, size_t> refs_;
+};
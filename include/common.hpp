@@ -8,5 +8,22 @@
 ssize_t safe_read(int fd, void* buf, size_t count);
 ssize_t safe_write(int fd, const void* buf, size_t count);
 
+// Socket helpers: write all of buf (no SIGPIPE if the peer has closed
+// the connection), and read exactly len bytes. False on error or EOF.
+bool write_all(int sockfd, const char* buf, size_t len);
+bool read_exact(int sockfd, char* buf, size_t len);
+
 // Fatal error helper.
-[[noreturn]] void die(const std::string& msg);
\ No newline at end of file
+[[noreturn]] void die(const std::string& msg);
+
+// Suffix of the sibling file write_file_atomic writes before renaming;
+// leftovers are from a crash mid-write and safe to delete
+constexpr char ATOMIC_TMP_SUFFIX[] = ".tmp";
+
+// Replace path with contents crash-safely: write path + ".tmp", fsync
+// it, rename it over path and fsync the directory. Readers see the old
+// file or the new one, never a torn one.
+bool write_file_atomic(const std::string& path, const std::string& contents);
+
+// fsync a directory so renames and new entries in it survive a crash
+bool sync_dir(const std::string& dir);
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Direct-addressed table keyed by a fixed-width decimal id (6-digit UIDs,
+// 3-digit EIDs). Slots live in pages of PAGE entries allocated on first
+// use, so entries never move: pointers stay valid until that key is
+// erased. Lookups parse the key and index a slot, with no allocation.
+// Iteration visits entries in ascending key order.
+template <typename T, std::size_t Digits>
+class DenseTable {
+public:
+    static constexpr std::size_t capacity() {
+        std::size_t n = 1;
+        for (std::size_t i = 0; i < Digits; ++i) n *= 10;
+        return n;
+    }
+
+    // Slot of a key with exactly Digits decimal digits, or -1
+    static long index_of(std::string_view key) {
+        if (key.size() != Digits) return -1;
+        long idx = 0;
+        for (char ch : key) {
+            if (ch < '0' || ch > '9') return -1;
+            idx = idx * 10 + (ch - '0');
+        }
+        return idx;
+    }
+
+    T* find(std::string_view key) { return slot(index_of(key)); }
+    const T* find(std::string_view key) const {
+        return const_cast<DenseTable*>(this)->slot(index_of(key));
+    }
+
+    // Value at slot idx (as returned by index_of), or nullptr
+    T* at(long idx) { return slot(idx); }
+    const T* at(long idx) const { return const_cast<DenseTable*>(this)->slot(idx); }
+
+    // Store value under key, replacing any previous entry. Returns
+    // nullptr if the key is not a valid id.
+    T* insert(std::string_view key, T value) {
+        long idx = index_of(key);
+        if (idx < 0) return nullptr;
+        auto& page = pages_[static_cast<std::size_t>(idx) / PAGE];
+        if (!page) page = std::make_unique<Page>();
+        auto& cell = (*page)[static_cast<std::size_t>(idx) % PAGE];
+        if (!cell) ++size_;
+        cell = std::move(value);
+        return &*cell;
+    }
+
+    bool erase(std::string_view key) {
+        long idx = index_of(key);
+        if (!slot(idx)) return false;
+        (*pages_[static_cast<std::size_t>(idx) / PAGE])
+            [static_cast<std::size_t>(idx) % PAGE].reset();
+        --size_;
+        return true;
+    }
+
+    void clear() {
+        for (auto& page : pages_) page.reset();
+        size_ = 0;
+    }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    template <typename F>
+    void for_each(F&& fn) {
+        for (auto& page : pages_) {
+            if (!page) continue;
+            for (auto& cell : *page)
+                if (cell) fn(*cell);
+        }
+    }
+
+    template <typename F>
+    void for_each(F&& fn) const {
+        for (const auto& page : pages_) {
+            if (!page) continue;
+            for (const auto& cell : *page)
+                if (cell) fn(*cell);
+        }
+    }
+
+private:
+    static constexpr std::size_t PAGE  = capacity() < 1000 ? capacity() : 1000;
+    static constexpr std::size_t PAGES = capacity() / PAGE;
+
+    using Page = std::array<std::optional<T>, PAGE>;
+
+    T* slot(long idx) {
+        if (idx < 0) return nullptr;
+        const auto& page = pages_[static_cast<std::size_t>(idx) / PAGE];
+        if (!page) return nullptr;
+        auto& cell = (*page)[static_cast<std::size_t>(idx) % PAGE];
+        return cell ? &*cell : nullptr;
+    }
+
+    std::array<std::unique_ptr<Page>, PAGES> pages_{};
+    std::size_t size_ = 0;
+};
@@ -1,11 +1,31 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <queue>
+#include <deque>
+#include <functional>
+
+#include "dense_table.hpp"
+#include "file_cache.hpp"
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 // Representa um utilizador
 struct User {
@@ -23,9 +43,12 @@ struct Event {
     std::string time;
     int attendance = 0;
     unsigned long fsize = 0;
-    std::string fname;
+    std::string fname;  // display name sent with SED
+    std::string blob;   // BlobStore key of the file ("" for older events: fname in cwd)
     int reserved = 0;
     bool closed = false;
+    time_t start = 0;   // date/time as epoch seconds, parsed once
+    bool past = false;  // start has passed (set by the expiry timer)
 };
 
 struct Reservation {
@@ -35,92 +58,423 @@ struct Reservation {
     std::string timestamp;
 };
 
+// TCP request types, and the kind of each header field (checked while
+// the header is lexed)
+enum class TcpCommand : uint8_t { Unknown, CPS, CRE, LST, CLS, RID, SED, LME, LMR, KAL };
+enum class TcpField   : uint8_t { Any, Uid, Pass, Name, Date, Time, Count, Eid, Fname };
+
+// One piece of a TCP reply: owned bytes, a shared buffer, a cached file
+// mapping, or a range of an open file (sent with sendfile, fd owned by
+// the segment)
+struct OutSegment {
+    std::string                        bytes;
+    std::shared_ptr<const std::string> shared;
+    std::shared_ptr<const MappedFile>  map;
+    int    fd  = -1;
+    off_t  off = 0;
+    size_t len = 0; // file bytes left to send
+
+    bool owned() const { return !map && !shared && fd < 0; }
+
+    std::string_view data() const {
+        if (map)    return std::string_view(map->data, map->size);
+        if (shared) return std::string_view(*shared);
+        return std::string_view(bytes);
+    }
+};
+
+// Sender of a UDP request, the socket the reply must leave from and the
+// reply itself (sent once the request's mutation is durable)
+struct UdpPeer {
+    int         sock = -1;
+    sockaddr_in addr{};
+    socklen_t   len  = sizeof(sockaddr_in);
+    std::string reply;
+    bool        binary = false; // request was a binary frame: so is the reply
+};
+
+// Replies to recent UDP requests that carried a request ID ("#<id>"),
+// keyed by sender and ID, so a retransmission is answered again instead
+// of being run twice. Entries expire after UDP_REPLY_TTL (30 s, in
+// es_server.cpp) or sooner once UDP_REPLY_MAX are cached; the reactor
+// that owns the socket is the only user.
+struct UdpReplyCache {
+    struct Key {
+        uint32_t ip;
+        uint16_t port;
+        uint32_t rid;
+        bool operator==(const Key& o) const {
+            return ip == o.ip && port == o.port && rid == o.rid;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            return std::hash<uint64_t>()((uint64_t(k.ip) << 32 | k.rid) ^
+                                         (uint64_t(k.port) << 16));
+        }
+    };
+    struct Entry {
+        std::string reply;
+        uint64_t    lsn; // WAL record the reply waits for (0: none)
+    };
+
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    std::deque<std::pair<time_t, Key>>      order; // oldest first
+};
+
+// Per-connection TCP state, advanced by the reactor as bytes arrive/leave
+struct Connection {
+    enum class State {
+        ReadCommand, // waiting for the command token
+        ReadArgs,    // waiting for the command's arguments
+        ReadBody,    // CRE: waiting for fsize bytes of file data
+        Processing,  // handed to a worker, or reply waiting for an fsync
+        Write        // flushing the reply
+    };
+
+    int   fd     = -1;
+    State state  = State::ReadCommand;
+    bool  eof    = false; // peer shut down its write side
+    bool  binary = false; // request was a binary frame: so is the reply
+
+    // Request header bytes. Arguments are views into it, so it is left
+    // untouched once the header is complete (later bytes go to body).
+    std::string in;
+    size_t      in_pos   = 0;
+    size_t      scan_pos = 0; // lexer resumes a partial token here
+    bool        in_full  = false; // reading stopped at MAX_HEADER_LEN, not EAGAIN
+
+    TcpCommand cmd   = TcpCommand::Unknown;
+    size_t     nargs = 0; // arguments expected for cmd
+    size_t     argc  = 0; // arguments received
+    std::array<std::pair<uint32_t, uint32_t>, 8> arg_span{}; // offset, length in 'in'
+    uint32_t            arg_ok = 0; // bit i: arg i is a well-formed field
+    std::array<long, 8> num{};      // value of Count fields (-1 otherwise)
+
+    // CRE file data, streamed into a temp file under data/ that the
+    // handler renames into place (removed here if it never is)
+    size_t      body_need   = 0;
+    size_t      body_got    = 0;
+    int         body_fd     = -1;
+    bool        body_failed = false; // could not store it; bytes are drained
+    std::string body_path;
+    int         body_pipe[2] = {-1, -1}; // socket -> pipe -> file (splice)
+
+    std::vector<OutSegment> out;  // reply, sent in order
+    size_t out_seg = 0;           // first unsent segment
+    size_t out_pos = 0;           // bytes of it already sent (memory segments)
+    bool   corked  = false;       // TCP_CORK set while a file is queued
+
+    // After KAL the connection carries one request after another, with
+    // the replies in request order. Bytes that arrive while a request is
+    // handled wait here, since 'in' must not change under the handler.
+    bool        keep_alive = false;
+    std::string pipelined;
+
+    ~Connection() { release_request(); }
+
+    // Close the files of the current request (removing an upload that
+    // was never stored) and drop its reply
+    void release_request() {
+        for (auto& seg : out)
+            if (seg.fd >= 0) ::close(seg.fd);
+        out.clear();
+        if (body_fd >= 0) ::close(body_fd);
+        if (body_pipe[0] >= 0) ::close(body_pipe[0]);
+        if (body_pipe[1] >= 0) ::close(body_pipe[1]);
+        if (!body_path.empty()) ::unlink(body_path.c_str());
+        body_fd = body_pipe[0] = body_pipe[1] = -1;
+        body_path.clear();
+    }
+
+    bool out_done() const { return out_seg == out.size(); }
+    std::string_view arg(size_t i) const {
+        return std::string_view(in).substr(arg_span[i].first, arg_span[i].second);
+    }
+    bool arg_valid(size_t i) const { return (arg_ok >> i) & 1u; }
+};
+
+// One epoll loop with its own UDP and TCP sockets (SO_REUSEPORT when
+// several reactors share the port) and the connections it accepted
+struct Reactor {
+    int epoll_fd = -1;
+    int udp_sock = -1;
+    int tcp_sock = -1;
+    int wake_fd  = -1; // eventfd: workers signal finished requests
+
+    std::unordered_map<int, std::unique_ptr<Connection>> conns;
+
+    std::mutex       done_mtx;
+    std::vector<int> done_fds; // connections with a reply ready
+
+    // Replies held until the WAL is durable up to their LSN (-d batched),
+    // also under done_mtx: TCP connections and UDP replies
+    std::vector<std::pair<uint64_t, int>>     parked_fds;
+    std::vector<std::pair<uint64_t, UdpPeer>> parked_udp;
+
+    // recvmmsg batch (reactor thread only): one slot per datagram, and
+    // the replies of the batch that go out together with sendmmsg
+    std::vector<mmsghdr>     udp_msgs;
+    std::vector<iovec>       udp_iov;
+    std::vector<sockaddr_in> udp_addrs;
+    std::vector<char>        udp_bufs;
+    std::vector<UdpPeer>     udp_out;
+    UdpReplyCache            reply_cache;
+};
+
+class ThreadPool;
+class WriteAheadLog;
+class BlobStore;
+struct WalRecord;
+
+// When a mutating request is acknowledged relative to its WAL record
+// reaching disk: never synced (page cache only), synced by a background
+// group commit before the reply goes out, or synced by the request itself
+enum class Durability : uint8_t { None, Batched, Strict };
+
+// Runtime configuration, filled in from the command line by es_main
+struct ServerOptions {
+    int  port     = 58000;
+    bool verbose  = false;
+    int  threads  = 0;         // TCP worker threads; 0 runs handlers on the reactor
+    int  reactors = 1;         // reactor threads, each with its own sockets
+    int  backlog  = SOMAXCONN; // listen() backlog per TCP socket
+    int  compact_secs = 60;    // interval between WAL compactions
+    bool watch_data   = false; // reload data/*.txt when edited externally
+    bool import_text  = false; // start from data/*.txt instead of state.bin
+    bool export_text  = false; // write data/*.txt and exit
+    long max_file_size = 10000000L; // largest CRE upload accepted
+    long file_cache_mb = 64;        // LRU of mapped event files for SED
+    Durability durability = Durability::None;
+    int  flush_ms      = 10;        // batched: group commit interval
+    int  flush_records = 64;        // batched: ... or this many records
+    int  udp_batch     = 32;        // datagrams per recvmmsg/sendmmsg
+};
+
 class EventServer {
 public:
-    EventServer(int port, bool verbose);
+    explicit EventServer(const ServerOptions& opts);
     ~EventServer();
 
     void run();
+    void export_text();
 
 private:
+    friend class ServerBench; // bench/microbench.cpp times the helpers below
+
     int port_;
     bool verbose_;
+    int threads_;
+    int backlog_;
+    int compact_secs_;
+    bool watch_data_;
+    bool import_text_;
+    long max_file_size_;
+    Durability durability_;
+    int flush_ms_;
+    int flush_records_;
+    int udp_batch_;
 
-    int udp_sock_ = -1;
-    int tcp_sock_ = -1;
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+    std::unique_ptr<ThreadPool>           pool_;
 
-    std::vector<User> users_;
-    std::vector<Event> events_;
+    DenseTable<User, 6>  users_;  // keyed by UID
+    DenseTable<Event, 3> events_; // keyed by EID
     std::vector<Reservation> reservations_;
 
+    // Serialized LST reply, valid while lst_version_ == events_version_
+    std::atomic<uint64_t>              events_version_{0};
+    std::mutex                         lst_mtx_;
+    std::shared_ptr<const std::string> lst_cache_;
+    std::shared_ptr<const std::string> lst_bin_cache_; // binary form, on demand
+    uint64_t                           lst_version_ = 0;
+
+    // Per-user indexes, maintained on insert so LME/LMR cost O(results):
+    // owner UID -> its EIDs ascending (under events_mtx_), and
+    // UID -> positions in reservations_ by (EID, timestamp)
+    // (under reservations_mtx_)
+    std::unordered_map<std::string, std::vector<std::string>> events_by_owner_;
+    std::unordered_map<std::string, std::vector<size_t>>      reservations_by_user_;
+
+    // Locks, always taken in this order:
+    //   snapshot_mtx_ -> wal_gate_ -> users_mtx_ -> events_mtx_ -> event lock
+    //   -> reservations_mtx_
+    // Mutating handlers hold wal_gate_ shared while they change state and
+    // log it; compaction holds it exclusively to snapshot consistently.
+    mutable std::shared_mutex wal_gate_;
+    mutable std::shared_mutex users_mtx_;         // users_ and every User
+    mutable std::shared_mutex events_mtx_;        // membership of events_
+    mutable std::array<std::mutex, 1000> event_locks_; // per-EID seats/closed
+    mutable std::mutex reservations_mtx_;         // reservations_
+
+    // --- event expiry: min-heap of (start, EID) driving a timerfd ---
+    // Lock order: events_mtx_ -> expiry_mtx_ -> event lock
+    int        timer_fd_ = -1;
+    std::mutex expiry_mtx_;
+    std::priority_queue<std::pair<time_t, std::string>,
+                        std::vector<std::pair<time_t, std::string>>,
+                        std::greater<>> expiry_;
+
+    // --- persistence: WAL + periodic snapshot compaction ---
+    std::unique_ptr<WriteAheadLog> wal_;
+    std::unique_ptr<BlobStore>     blobs_; // event files (refs under events_mtx_)
+    std::unique_ptr<FileCache>     file_cache_;
+    int                            signal_fd_ = -1; // SIGUSR1: print stats
+    std::thread                    compactor_;
+    std::thread                    watcher_;
+    std::mutex                     compact_mtx_;
+    std::condition_variable        compact_cv_;
+    bool                           compact_requested_ = false;
+    std::thread                    flusher_; // -d batched
+    std::mutex                     flush_mtx_;
+    std::condition_variable        flush_cv_;
+    bool                           flush_requested_ = false;
+    std::atomic<bool>              stopping_{false};
+
+    // Held while the snapshot (data/state.bin, and data/*.txt when they
+    // are mirrored) is written or re-read
+    std::mutex                         snapshot_mtx_;
+    std::map<std::string, std::string> own_writes_; // file -> signature
+
     // --- sockets ---
     bool init_sockets();
-    void main_loop();
-    void handle_udp_request();
-    void handle_tcp_client(int conn_fd);
+    bool init_reactor(Reactor& r);
+    void main_loop(Reactor& r);
+    bool handle_udp_batch(Reactor& r);
+    void handle_udp_request(const char* msg, UdpPeer& peer);
+    void report_stats();
+
+    // --- TCP reactor ---
+    void accept_clients(Reactor& r);
+    void handle_connection_event(Reactor& r, int fd, uint32_t events);
+    bool fill_input(Connection& c);
+    void start_body(Connection& c);
+    ssize_t receive_body(Connection& c);
+    bool advance_connection(Reactor& r, Connection& c);
+    bool flush_output(Connection& c);
+    bool next_request(Connection& c);
+    bool unframe_request(Connection& c, bool& ready);
+    void close_connection(Reactor& r, int fd);
+    void dispatch_request(Reactor& r, Connection& c);
+    void complete_requests(Reactor& r);
+    void handle_tcp_request(Connection& c);
+    bool await_durable(Reactor& r, int fd);
+    bool udp_reply_ready(Reactor& r, UdpPeer& peer, uint64_t lsn,
+                         uint64_t& sync_lsn);
+    bool answer_retransmit(Reactor& r, UdpPeer& peer, uint32_t rid);
+    void remember_reply(Reactor& r, const UdpPeer& peer, uint32_t rid,
+                        uint64_t lsn);
+    void release_parked();
+    void flusher_loop();
 
     // --- helpers ---
-    User* find_user(const std::string& uid);
-    Event* find_event(const std::string& eid);
-    bool valid_uid(const std::string& uid) const;
-    bool valid_password(const std::string& pass) const;
-    bool valid_event_name(const std::string& name) const;
-    bool valid_event_datetime(const std::string& date, const std::string& time) const;
+    User* find_user(std::string_view uid);
+    Event* find_event(std::string_view eid);
+    std::mutex& event_lock(std::string_view eid) const;
+    void index_event(const Event& ev);
+    void add_reservation(Reservation r);
+    void schedule_expiry(Event& ev);
+    void arm_expiry_timer();
+    void expire_events();
+    void events_changed();
+    bool valid_uid(std::string_view uid) const;
+    bool valid_password(std::string_view pass) const;
+    bool valid_event_name(std::string_view name) const;
+    bool valid_event_date(std::string_view date) const;
+    bool valid_event_time(std::string_view time) const;
+    bool valid_file_name(std::string_view fname) const;
     int  compute_event_state(const Event& ev) const;
 
     std::string allocate_eid();
 
+    // dump_* render a table in its data/*.txt format and pack_* append
+    // it as data/state.bin records, logging and skipping any that do not
+    // fit; the caller holds the table's lock (dump_events/pack_events
+    // take the event locks themselves).
     void ensure_data_dir();
-    void save_users();
+    size_t load_state(bool from_text);
+    void clear_state();
+    void restore_state();
+    void reload_state();
+    void watch_loop();
+    void restore_event(Event ev);
+    uint64_t load_snapshot(uint64_t checkpoint);
+    std::string dump_users() const;
+    void pack_users(std::string& out, uint64_t& count) const;
     void load_users();
-    void save_events();
+    std::string dump_events() const;
+    void pack_events(std::string& out, uint64_t& count) const;
     void load_events();
-    void save_reservations();
+    std::string dump_reservations() const;
+    void pack_reservations(std::string& out, uint64_t& count) const;
     void load_reservations();
 
+    bool log_mutation(const WalRecord& rec);
+    void apply_record(const WalRecord& rec);
+    void compact(bool force = false);
+    void compactor_loop();
+
 
 
     // --- UDP handlers ---
     void handle_LIN(const std::string& uid,
                     const std::string& pass,
-                    sockaddr_in& cliaddr,
-                    socklen_t cli_len);
+                    UdpPeer& peer);
 
     void handle_LOU(const std::string& uid,
                     const std::string& pass,
-                    sockaddr_in& cliaddr,
-                    socklen_t cli_len);
+                    UdpPeer& peer);
 
     void handle_UNR(const std::string& uid,
                     const std::string& pass,
-                    sockaddr_in& cliaddr,
-                    socklen_t cli_len);
+                    UdpPeer& peer);
 
     void handle_LME(const std::string& uid,
                     const std::string& pass,
-                    sockaddr_in& cliaddr,
-                    socklen_t cli_len);
+                    const std::string& cursor,
+                    UdpPeer& peer);
 
     void handle_LMR(const std::string& uid,
                     const std::string& pass,
-                    sockaddr_in& cliaddr,
-                    socklen_t cli_len);
+                    const std::string& cursor,
+                    UdpPeer& peer);
 
-    void send_udp_reply(const std::string& reply,
-                        sockaddr_in& cliaddr,
-                        socklen_t cli_len);
+    void send_udp_reply(const std::string& reply, UdpPeer& peer);
 
+    // One entry of an LME/LMR list (" EID ...") and the cursor that
+    // resumes the list after it
+    struct ListItem {
+        std::string text;
+        std::string cursor;
+    };
+    std::string my_events(const std::string& uid, const std::string& pass,
+                          const std::string& cursor, std::vector<ListItem>& items);
+    std::string my_reservations(const std::string& uid, const std::string& pass,
+                                const std::string& cursor,
+                                std::vector<ListItem>& items);
+    void send_udp_list(const char* type, const std::vector<ListItem>& items,
+                       bool resumed, UdpPeer& peer);
 
-    // --- TCP token reader ---
-    bool read_token(int fd, std::string& tok);
+
+    // --- TCP header lexer ---
+    bool next_token(Connection& c, std::string_view& tok);
+    bool check_field(TcpField kind, std::string_view tok, long& num) const;
+    bool cre_header_valid(const Connection& c) const;
 
     // --- TCP handlers ---
-    void handle_CPS(int fd); // changePass
-    void handle_CRE(int fd); // create event
-    void handle_LST(int fd); // list events
-    void handle_CLS(int fd); // close event
-    void handle_RID(int fd); // reserve
-    void handle_SED(int fd); // show
-
-    void send_tcp_line(int fd, const std::string& line);
+    void handle_CPS(Connection& c); // changePass
+    void handle_CRE(Connection& c); // create event
+    void handle_LST(Connection& c); // list events
+    std::string build_lst_reply() const;
+    void handle_CLS(Connection& c); // close event
+    void handle_RID(Connection& c); // reserve
+    void handle_SED(Connection& c); // show
+    void handle_LME(Connection& c); // myevents, in full
+    void handle_LMR(Connection& c); // myreservations, in full
+    void handle_KAL(Connection& c); // keep the connection open
+
+    bool send_tcp_line(Connection& c, const std::string& line);
+    void send_tcp_shared(Connection& c, std::shared_ptr<const std::string> buf);
+    void send_tcp_mapped(Connection& c, std::shared_ptr<const MappedFile> map);
+    void send_tcp_file(Connection& c, int fd, off_t off, size_t len);
 };
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Read-only mapping of the first 'size' bytes of a file; unmapped when
+// the last reference (cache entry or queued reply) goes away
+struct MappedFile {
+    const char* data = nullptr;
+    size_t      size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+};
+
+// Byte-budgeted LRU of mapped event files, keyed by path. Blob paths are
+// content-addressed, so an entry only goes stale if the file is swapped
+// behind the server's back; clear() covers that (state reloads).
+class FileCache {
+public:
+    explicit FileCache(size_t budget_bytes);
+
+    // Mapping of path covering size bytes, from the cache or mapped now.
+    // nullptr when caching is off, the file is too large to be worth
+    // caching, or it cannot be mapped: callers fall back to sendfile.
+    std::shared_ptr<const MappedFile> get(const std::string& path, size_t size);
+
+    void clear();
+
+    struct Stats {
+        size_t   entries = 0;
+        size_t   bytes   = 0;
+        uint64_t hits    = 0;
+        uint64_t misses  = 0;
+    };
+    Stats stats() const;
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const MappedFile>>;
+
+    size_t budget_;
+
+    mutable std::mutex mtx_;
+    std::list<Entry>   lru_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t   bytes_  = 0;
+    uint64_t hits_   = 0;
+    uint64_t misses_ = 0;
+};
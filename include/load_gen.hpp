@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+// Requests the load generator issues, in report order
+enum class BenchCommand { LIN, LME, LMR, CRE, LST, RID, SED };
+constexpr size_t BENCH_COMMANDS = 7;
+constexpr const char* BENCH_COMMAND_NAMES[BENCH_COMMANDS] = {
+    "LIN", "LME", "LMR", "CRE", "LST", "RID", "SED"};
+
+struct LoadOptions {
+    std::string server_ip   = "127.0.0.1";
+    int         port        = 58000;
+    int         connections = 8;     // concurrent simulated users
+    int         seconds     = 10;    // length of the measured run
+    int         users       = 1000;  // synthetic user population
+    int         events      = 100;   // events created before the run
+    double      zipf_s      = 1.0;   // skew of event popularity
+    long        file_size   = 1000;  // bytes uploaded by each CRE
+    bool        keep_alive  = true;  // one KAL connection per user
+    bool        binary      = false; // binary frames, if the server offers them
+
+    // Relative frequency of each command, indexed by BenchCommand
+    unsigned    weights[BENCH_COMMANDS] = {5, 10, 10, 1, 20, 30, 24};
+};
+
+// Closed-loop load generator: each simulated user sends one request,
+// waits for the whole reply and sends the next. Users act for accounts
+// drawn from a registered population, and RID/SED target events drawn
+// from a Zipf distribution, so a few events are hot.
+class LoadGenerator {
+public:
+    explicit LoadGenerator(const LoadOptions& opts);
+    ~LoadGenerator();
+
+    // Register the population, create the events, run the mix for
+    // opts.seconds and print throughput and latency per command.
+    // False if the server could not be reached or set up.
+    bool run();
+
+private:
+    struct Worker;
+
+    LoadOptions opts_;
+    sockaddr_in addr_{};
+
+    std::vector<std::string>             uids_;
+    std::vector<std::string>             eids_;    // by popularity rank
+    std::string                          file_;    // CRE upload body
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    bool resolve();
+    bool setup();
+    void report(double seconds) const;
+};
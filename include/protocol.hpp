@@ -1,22 +1,67 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace protocol {
 
-// UDP builders
-std::string build_login         (const std::string& uid, const std::string& pass);
-std::string build_logout        (const std::string& uid, const std::string& pass);
-std::string build_unregister    (const std::string& uid, const std::string& pass);
-std::string build_myevents      (const std::string& uid, const std::string& pass);
-std::string build_myreservations(const std::string& uid, const std::string& pass);
+// Builders append one request to out. A caller that reuses out (after
+// clear()) sends a stream of requests without allocating; numbers are
+// formatted with to_chars and fields are copied whole, never truncated.
 
-// TCP builders
+// UDP requests. A non-zero rid is appended as "#<rid>": the server then
+// answers a retransmission from its reply cache instead of re-running it.
+void append_login         (std::string& out, std::string_view uid,
+                           std::string_view pass, uint32_t rid = 0);
+void append_logout        (std::string& out, std::string_view uid,
+                           std::string_view pass, uint32_t rid = 0);
+void append_unregister    (std::string& out, std::string_view uid,
+                           std::string_view pass, uint32_t rid = 0);
+
+// List requests. A reply too long for one datagram ends in "@<cursor>";
+// passing that cursor asks for the next page. The same line without rid
+// or cursor, sent over TCP, returns the whole list.
+void append_myevents      (std::string& out, std::string_view uid,
+                           std::string_view pass, uint32_t rid = 0,
+                           std::string_view cursor = {});
+void append_myreservations(std::string& out, std::string_view uid,
+                           std::string_view pass, uint32_t rid = 0,
+                           std::string_view cursor = {});
+
+// TCP requests
+void append_change_pass   (std::string& out, std::string_view uid,
+                           std::string_view oldPass, std::string_view newPass);
+void append_create_header (std::string& out, std::string_view uid,
+                           std::string_view pass, std::string_view name,
+                           std::string_view date, std::string_view time,
+                           int attendance, std::string_view fname, long fsize);
+void append_list          (std::string& out);
+void append_close         (std::string& out, std::string_view uid,
+                           std::string_view pass, std::string_view eid);
+void append_reserve       (std::string& out, std::string_view uid,
+                           std::string_view pass, std::string_view eid,
+                           int people);
+void append_show          (std::string& out, std::string_view eid);
+
+// Ask the server to keep the TCP connection open for further requests
+void append_keep_alive    (std::string& out);
+
+// The same requests as new strings
+std::string build_login         (const std::string& uid, const std::string& pass,
+                                 uint32_t rid = 0);
+std::string build_logout        (const std::string& uid, const std::string& pass,
+                                 uint32_t rid = 0);
+std::string build_unregister    (const std::string& uid, const std::string& pass,
+                                 uint32_t rid = 0);
+std::string build_myevents      (const std::string& uid, const std::string& pass,
+                                 uint32_t rid = 0, const std::string& cursor = "");
+std::string build_myreservations(const std::string& uid, const std::string& pass,
+                                 uint32_t rid = 0, const std::string& cursor = "");
 std::string build_change_pass   (const std::string& uid,
                                  const std::string& oldPass,
                                  const std::string& newPass);
-
-// protocol.hpp
 std::string build_create_header (const std::string& uid,
                                  const std::string& pass,
                                  const std::string& name,
@@ -25,28 +70,60 @@ std::string build_create_header (const std::string& uid,
                                  int attendance,
                                  const std::string& fname,
                                  long fsize);
-
-
 std::string build_list();
-
 std::string build_close         (const std::string& uid,
                                  const std::string& pass,
                                  const std::string& eid);
-
 std::string build_reserve       (const std::string& uid,
                                  const std::string& pass,
                                  const std::string& eid,
                                  int people);
-
 std::string build_show          (const std::string& eid);
+std::string build_keep_alive();
+
+// A reply line viewed in place (valid while the line is): its type and
+// status, and the remaining fields, tokenized only as they are read
+struct Reply {
+    std::string_view type;   // e.g. RLI, RLO, RUR, RCP, RCE, RLS, RME, RMR, RCL, RRI, RSE, ERR
+    std::string_view status; // e.g. OK, NOK, ERR, ...
+    std::string_view rest;   // remaining fields, consumed by next()
+
+    // Take the next field; false when none is left
+    bool next(std::string_view& tok);
 
-// Generic response line parser
-struct ResponseLine {
-    std::string type;   // e.g. RLI, RLO, RUR, RCP, RCE, RLS, RME, RMR, RCL, RRI, RSE, ERR
-    std::string status; // e.g. OK, NOK, ERR, ...
-    std::string rest;   // remaining tokens (if any)
+    // Take the next record of N fields (an RLS event, an RMR reservation,
+    // ...); false unless all N are there
+    template <size_t N>
+    bool next(std::string_view (&rec)[N]) {
+        for (auto& field : rec)
+            if (!next(field)) return false;
+        return true;
+    }
 };
 
-ResponseLine parse_response_line(const std::string& line);
+Reply parse_reply(std::string_view line);
+
+// Binary framing: an opt-in compact form of every message, used with a
+// server whose KAL reply advertises "BIN". A frame is a 6-byte header
+// (BINARY_MAGIC, which never starts a text message; the message type as
+// a u8 op; the payload size as u32), then the message's fields in text
+// order at fixed width: UIDs u32, EIDs u16, seats, counts and request
+// IDs u32, file sizes u64, the reply status u8, and text fields
+// NUL-padded (password 8, name 10, date 10, time 8, Fname 24,
+// cursor 16). A list is a u32 count and its records. As in text, CRE
+// and RSE file data follows the frame. Integers are little-endian.
+constexpr uint8_t BINARY_MAGIC = 0xB7;
+constexpr size_t  FRAME_HEADER = 6;
+
+// Size of the frame at p (header included) once its header is in, else 0
+size_t frame_size(const char* p, size_t n);
+
+// Append the frame for a text message; false (out unchanged) if the
+// message has no binary form, e.g. a malformed field
+bool encode_binary(std::string_view text, std::string& out);
+
+// Append the text form of a whole frame (ending in '\n', or in ' '
+// when file data follows); false (text unchanged) if it is malformed
+bool decode_binary(std::string_view frame, std::string& text);
 
 }
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Binary snapshot (data/state.bin): a Header, then header.users
+// UserRecords, header.events EventRecords and header.reservations
+// ReservationRecords. Integers are host (little-endian) order; text
+// fields are NUL-padded and not terminated when full. header.crc is the
+// CRC-32 of everything after the header. header.wal_next is the first
+// WAL segment not folded into the snapshot.
+namespace snapshot {
+
+constexpr char     MAGIC[8] = {'E', 'S', 'S', 'N', 'A', 'P', '\r', '\n'};
+constexpr uint32_t VERSION  = 1;
+
+struct Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t crc;
+    uint64_t users;
+    uint64_t events;
+    uint64_t reservations;
+    uint64_t wal_next;
+};
+
+struct UserRecord {
+    char uid[6];
+    char password[8];
+    char pad[2];
+};
+
+struct EventRecord {
+    uint64_t fsize;
+    int32_t  attendance;
+    int32_t  reserved;
+    char     eid[3];
+    char     owner_uid[6];
+    char     name[10];
+    char     date[10];
+    char     time[8];
+    char     fname[24];
+    char     blob[64];
+    char     closed;
+    char     pad[2];
+};
+
+struct ReservationRecord {
+    int32_t seats;
+    char    uid[6];
+    char    eid[3];
+    char    timestamp[19];
+};
+
+static_assert(sizeof(Header) == 48, "snapshot header layout");
+static_assert(sizeof(UserRecord) == 16, "snapshot user layout");
+static_assert(sizeof(EventRecord) == 144, "snapshot event layout");
+static_assert(sizeof(ReservationRecord) == 32, "snapshot reservation layout");
+
+// CRC-32 (IEEE), continuing from crc
+uint32_t crc32(const void* data, size_t len, uint32_t crc = 0);
+
+// Copy s into a fixed-width field; false if it does not fit
+template <size_t N>
+bool put(char (&field)[N], std::string_view s) {
+    if (s.size() > N) return false;
+    s.copy(field, N);
+    for (size_t i = s.size(); i < N; ++i) field[i] = '\0';
+    return true;
+}
+
+// Text of a fixed-width field
+template <size_t N>
+std::string_view get(const char (&field)[N]) {
+    size_t n = 0;
+    while (n < N && field[n] != '\0') ++n;
+    return std::string_view(field, n);
+}
+
+// Header plus the three record arrays, with the CRC filled in
+std::string assemble(const std::string& users, uint64_t nusers,
+                     const std::string& events, uint64_t nevents,
+                     const std::string& reservations, uint64_t nreservations,
+                     uint64_t wal_next);
+
+} // namespace snapshot
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads consuming a FIFO task queue
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+private:
+    std::vector<std::thread>          workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex                        mtx_;
+    std::condition_variable           cv_;
+    bool                              stopping_ = false;
+
+    void worker_loop();
+};
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 class UserClient {
 public:
     UserClient(const std::string& serverIp, int serverPort);
+    ~UserClient();
     void run();
 
 private:
@@ -15,14 +17,33 @@ private:
     std::string currentUid_;
     std::string currentPass_;
 
+    uint32_t    next_rid_; // UDP request IDs, from a random start
+
+    // TCP connection kept open between requests (KAL), or -1
+    int         tcp_fd_         = -1;
+    bool        tcp_keep_alive_ = true; // false once the server declines
+    bool        binary_         = false; // server takes binary frames (KAL)
+
+    uint32_t next_request_id();
+
     void print_help() const;
     void handle_command(const std::string& line);
 
-    // UDP helper
+    // UDP helper (retransmits with backoff until a reply arrives)
     std::string send_udp_request(const std::string& msg);
 
-    // TCP helper (send, then read one line, then close)
-    std::string send_tcp_request(const std::string& msg);
+    // TCP helpers: the connection for the next request (reused if the
+    // server keeps it alive), and its release after the reply
+    int  tcp_connect();
+    void tcp_release(bool failed);
+
+    // Send msg and an optional body, then read one line
+    std::string send_tcp_request(const std::string& msg,
+                                 const char* body = nullptr,
+                                 size_t body_len = 0);
+
+    // Whole LME/LMR reply, gathered from UDP pages or fetched over TCP
+    std::string request_list(bool reservations);
 
     // Commands
     void cmd_login        (const std::string& uid, const std::string& pass);
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Mutation record types; the tag is the first token of each log line
+enum class WalOp : char {
+    UserRegistered  = 'U', // uid password
+    PasswordChanged = 'P', // uid password
+    UserRemoved     = 'D', // uid
+    EventCreated    = 'E', // eid owner name date time attendance fname fsize blob
+    EventClosed     = 'C', // eid
+    SeatsReserved   = 'R'  // uid eid seats date time
+};
+
+struct WalRecord {
+    WalOp                    op;
+    std::vector<std::string> fields; // whitespace-free tokens
+};
+
+// Append-only log of state mutations, split into numbered segment files
+// (<dir>/wal-NNNNNN.log). A snapshot covers every segment below a
+// checkpoint; later segments are replayed on top of it at startup.
+//
+// Appends only reach the page cache. Each record gets a log sequence
+// number (LSN, counted from 1 per process); sync() makes every record
+// appended so far durable and durable() reports how far that has got.
+class WriteAheadLog {
+public:
+    explicit WriteAheadLog(std::string dir);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Segment numbers present on disk, oldest first
+    std::vector<uint64_t> segments() const;
+
+    // Feed every complete record of segments >= first to apply, in order.
+    // A torn last line (crash mid-append) is ignored.
+    void replay(uint64_t first,
+                const std::function<void(const WalRecord&)>& apply) const;
+
+    // Start appending to a new, empty segment
+    bool open_segment(uint64_t seq);
+
+    // Append one record, setting lsn to its sequence number and size to
+    // the active segment's size afterwards. False if it could not be
+    // written whole: no LSN is assigned and nothing of it stays in the log.
+    bool append(const WalRecord& rec, uint64_t& lsn, size_t& size);
+
+    // fdatasync the records appended so far. Concurrent callers share
+    // one sync (group commit); sync_to returns at once if lsn is already
+    // durable. Returns the durable LSN.
+    uint64_t sync();
+    uint64_t sync_to(uint64_t lsn);
+
+    uint64_t appended() const;
+    uint64_t durable() const { return durable_.load(); }
+
+    // Switch appends to segment current+1; returns the new segment
+    // number, or 0 if it could not be opened (appends stay on the old one)
+    uint64_t rotate();
+
+    uint64_t current_segment() const;
+    size_t   current_size() const;
+
+    // Delete segments older than seq (already covered by a snapshot)
+    void remove_before(uint64_t seq);
+
+    // Checkpoint: first segment not covered by the snapshot files
+    uint64_t read_checkpoint() const;
+    bool     write_checkpoint(uint64_t seq);
+
+private:
+    std::string        dir_;
+    mutable std::mutex mtx_;
+    int                fd_   = -1;
+    uint64_t           seq_  = 0;
+    size_t             size_ = 0;
+    uint64_t           lsn_  = 0; // last appended record
+
+    std::mutex            sync_mtx_; // one fdatasync at a time
+    std::atomic<uint64_t> durable_{0};
+
+    std::string segment_path(uint64_t seq) const;
+    void        mark_durable(uint64_t lsn);
+};
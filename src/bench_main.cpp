@@ -0,0 +1,76 @@
+using namespace ::std;
+
+#include "load_gen.hpp"
+
+#include <iostream>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+// Parse "LIN=5,RID=30,..." into weights; commands not listed get 0
+static bool parse_mix(const string& spec, unsigned (&weights)[BENCH_COMMANDS]) {
+    unsigned parsed[BENCH_COMMANDS] = {};
+    unsigned total = 0;
+    istringstream iss(spec);
+    string item;
+    while (getline(iss, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == string::npos) return false;
+        string name = item.substr(0, eq);
+        size_t c = 0;
+        while (c < BENCH_COMMANDS && name != BENCH_COMMAND_NAMES[c]) ++c;
+        if (c == BENCH_COMMANDS) return false;
+        parsed[c] = static_cast<unsigned>(max(0, atoi(item.c_str() + eq + 1)));
+        total += parsed[c];
+    }
+    if (total == 0) return false;
+    copy(begin(parsed), end(parsed), begin(weights));
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // Default load configuration
+    LoadOptions opts;
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            opts.server_ip = argv[++i];
+        } else if (arg == "-p" && i + 1 < argc) {
+            opts.port = atoi(argv[++i]);
+        } else if (arg == "-c" && i + 1 < argc) {
+            opts.connections = max(1, atoi(argv[++i]));
+        } else if (arg == "-d" && i + 1 < argc) {
+            opts.seconds = max(1, atoi(argv[++i]));
+        } else if (arg == "-u" && i + 1 < argc) {
+            opts.users = min(900000, max(1, atoi(argv[++i])));
+        } else if (arg == "-e" && i + 1 < argc) {
+            opts.events = min(999, max(1, atoi(argv[++i])));
+        } else if (arg == "-z" && i + 1 < argc) {
+            opts.zipf_s = max(0.0, atof(argv[++i]));
+        } else if (arg == "-f" && i + 1 < argc) {
+            opts.file_size = max(1L, atol(argv[++i]));
+        } else if (arg == "-m" && i + 1 < argc) {
+            if (!parse_mix(argv[++i], opts.weights)) {
+                cerr << "Bad mix '" << argv[i] << "' (e.g. LIN=5,LST=20,RID=30;"
+                        " commands: LIN LME LMR CRE LST RID SED)\n";
+                return 1;
+            }
+        } else if (arg == "-o") {
+            opts.keep_alive = false;
+        } else if (arg == "-b") {
+            opts.binary = true;
+        } else {
+            cerr << "Usage: " << argv[0]
+                 << " [-n ESIP] [-p ESport] [-c users] [-d seconds]"
+                    " [-u accounts] [-e events] [-z zipf_s] [-f file_bytes]"
+                    " [-m LIN=w,LME=w,...] [-o] [-b]\n";
+            return 1;
+        }
+    }
+
+    // Run the load
+    LoadGenerator gen(opts);
+    return gen.run() ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+using namespace ::std;
+
+#include "blob_store.hpp"
+#include "common.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// ---------- SHA-256 (FIPS 180-4) ----------
+
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+struct Sha256 {
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char block[64];
+    size_t   used  = 0;
+    uint64_t total = 0;
+
+    void compress(const unsigned char* p) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = uint32_t(p[4 * i]) << 24 | uint32_t(p[4 * i + 1]) << 16 |
+                   uint32_t(p[4 * i + 2]) << 8 | uint32_t(p[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) +
+                          ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) +
+                          ((a & b) ^ (a & c) ^ (b & c));
+            k = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+        h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+    }
+
+    void update(const unsigned char* p, size_t n) {
+        total += n;
+        if (used > 0) {
+            size_t take = min(n, sizeof(block) - used);
+            memcpy(block + used, p, take);
+            used += take; p += take; n -= take;
+            if (used < sizeof(block)) return;
+            compress(block);
+            used = 0;
+        }
+        for (; n >= 64; p += 64, n -= 64) compress(p);
+        memcpy(block, p, n);
+        used = n;
+    }
+
+    string hex() {
+        uint64_t bits = total * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        unsigned char zero = 0;
+        while (used != 56) update(&zero, 1);
+        unsigned char len[8];
+        for (int i = 0; i < 8; ++i) len[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+        update(len, 8);
+
+        static const char digits[] = "0123456789abcdef";
+        string out;
+        for (uint32_t v : h) {
+            for (int s = 28; s >= 0; s -= 4) out.push_back(digits[(v >> s) & 0xf]);
+        }
+        return out;
+    }
+};
+
+} // namespace
+
+// ---------- BlobStore ----------
+
+BlobStore::BlobStore(string dir) : dir_(move(dir)) {
+    ::mkdir(dir_.c_str(), 0755);
+}
+
+// Hash a file by streaming it through SHA-256 (it is usually still in
+// the page cache right after the upload)
+string BlobStore::hash_file(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return "";
+
+    Sha256 sha;
+    unsigned char buf[1 << 16];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            return "";
+        }
+        sha.update(buf, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    return sha.hex();
+}
+
+bool BlobStore::store(const string& tmp_path, const string& key, bool durable) {
+    string dst = path(key);
+    struct stat st;
+    if (::stat(dst.c_str(), &st) == 0) {
+        ::unlink(tmp_path.c_str()); // same bytes already stored
+        return true;
+    }
+    if (durable) {
+        int fd = ::open(tmp_path.c_str(), O_RDONLY | O_CLOEXEC);
+        bool synced = fd >= 0 && ::fdatasync(fd) == 0;
+        if (fd >= 0) ::close(fd);
+        if (!synced) {
+            perror("sync blob");
+            return false;
+        }
+    }
+    if (::rename(tmp_path.c_str(), dst.c_str()) != 0) {
+        perror("rename blob");
+        return false;
+    }
+    if (durable && !sync_dir(dir_)) {
+        perror("sync blob directory");
+        return false;
+    }
+    return true;
+}
+
+void BlobStore::add_ref(const string& key) {
+    ++refs_[key];
+}
+
+void BlobStore::clear_refs() {
+    refs_.clear();
+}
+
+size_t BlobStore::sweep() {
+    size_t removed = 0;
+    DIR* d = ::opendir(dir_.c_str());
+    if (!d) return 0;
+    while (dirent* de = ::readdir(d)) {
+        if (de->d_name[0] == '.') continue;
+        if (refs_.count(de->d_name)) continue;
+        if (::unlink(path(de->d_name).c_str()) == 0) ++removed;
+    }
+    ::closedir(d);
+    return removed;
+}
+
+string BlobStore::path(const string& key) const {
+    return dir_ + "/" + key;
+}
@@ -7,6 +7,9 @@ using namespace ::std;
 #include <cerrno>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/socket.h>
+
 // Wrapper for read system call
 ssize_t safe_read(int fd, void* buf, size_t count) {
     return read(fd, buf, count);
@@ -17,6 +20,26 @@ ssize_t safe_write(int fd, const void* buf, size_t count) {
     return write(fd, buf, count);
 }
 
+bool write_all(int sockfd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::send(sockfd, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        buf += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool read_exact(int sockfd, char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::read(sockfd, buf, len);
+        if (n <= 0) return false;
+        buf += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
 // Print error message and exit program with failure status
 [[noreturn]] void die(const string& msg) {
     cerr << msg;
@@ -26,4 +49,37 @@ ssize_t safe_write(int fd, const void* buf, size_t count) {
     }
     cerr << endl;
     exit(EXIT_FAILURE);
-}
\ No newline at end of file
+}
+
+bool write_file_atomic(const string& path, const string& contents) {
+    string tmp = path + ATOMIC_TMP_SUFFIX;
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    size_t off = 0;
+    while (off < contents.size()) {
+        ssize_t n = ::write(fd, contents.data() + off, contents.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        off += static_cast<size_t>(n);
+    }
+    bool ok = off == contents.size() && ::fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+
+    size_t slash = path.rfind('/');
+    return sync_dir(slash == string::npos ? "." : path.substr(0, slash));
+}
+
+bool sync_dir(const string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
@@ -4,27 +4,74 @@ using namespace ::std;
 
 #include <iostream>
 #include <cstdlib>
+#include <thread>
 
 int main(int argc, char* argv[]) {
     // Default server configuration
-    int port = 58000;
-    bool verbose = false;
+    ServerOptions opts;
+    opts.threads = static_cast<int>(max(1u, thread::hardware_concurrency()));
 
     // Parse command-line arguments
     for (int i = 1; i < argc; ++i) {
         string arg = argv[i];
         if (arg == "-p" && i + 1 < argc) {
-            port = atoi(argv[++i]);
+            opts.port = atoi(argv[++i]);
         } else if (arg == "-v") {
-            verbose = true;
+            opts.verbose = true;
+        } else if (arg == "-t" && i + 1 < argc) {
+            opts.threads = max(0, atoi(argv[++i]));
+        } else if (arg == "-r" && i + 1 < argc) {
+            opts.reactors = max(1, atoi(argv[++i]));
+        } else if (arg == "-b" && i + 1 < argc) {
+            opts.backlog = max(1, atoi(argv[++i]));
+        } else if (arg == "-c" && i + 1 < argc) {
+            opts.compact_secs = max(1, atoi(argv[++i]));
+        } else if (arg == "-w") {
+            opts.watch_data = true;
+        } else if (arg == "-m" && i + 1 < argc) {
+            opts.max_file_size = max(1L, atol(argv[++i]));
+        } else if (arg == "-f" && i + 1 < argc) {
+            opts.file_cache_mb = max(0L, atol(argv[++i]));
+        } else if (arg == "-d" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "none") {
+                opts.durability = Durability::None;
+            } else if (mode == "batched") {
+                opts.durability = Durability::Batched;
+            } else if (mode == "strict") {
+                opts.durability = Durability::Strict;
+            } else {
+                cerr << "Unknown durability mode '" << mode
+                     << "' (none, batched or strict)\n";
+                return 1;
+            }
+        } else if (arg == "-g" && i + 1 < argc) {
+            opts.flush_ms = max(1, atoi(argv[++i]));
+        } else if (arg == "-n" && i + 1 < argc) {
+            opts.flush_records = max(1, atoi(argv[++i]));
+        } else if (arg == "-u" && i + 1 < argc) {
+            opts.udp_batch = max(1, atoi(argv[++i]));
+        } else if (arg == "-i") {
+            opts.import_text = true;
+        } else if (arg == "-x") {
+            opts.export_text = true;
         } else {
-            cerr << "Usage: " << argv[0] << " [-p ESport] [-v]\n";
+            cerr << "Usage: " << argv[0]
+                 << " [-p ESport] [-v] [-t threads] [-r reactors] [-b backlog]"
+                    " [-c compact_secs] [-w] [-m max_file_bytes]"
+                    " [-f file_cache_mb] [-d none|batched|strict]"
+                    " [-g flush_ms] [-n flush_records] [-u udp_batch]"
+                    " [-i] [-x]\n";
             return 1;
         }
     }
 
     // Start event server
-    EventServer server(port, verbose);
+    EventServer server(opts);
+    if (opts.export_text) {
+        server.export_text();
+        return 0;
+    }
     server.run();
     return 0;
-}
\ No newline at end of file
+}
@@ -1,6 +1,12 @@
 using namespace ::std;
 
 #include "es_server.hpp"
+#include "thread_pool.hpp"
+#include "wal.hpp"
+#include "blob_store.hpp"
+#include "snapshot.hpp"
+#include "common.hpp"
+#include "protocol.hpp"
 
 #include <iostream>
 #include <sstream>
@@ -10,53 +16,301 @@ using namespace ::std;
 #include <cstring>
 #include <algorithm>
 #include <ctime>
+#include <cerrno>
+#include <thread>
+#include <chrono>
+#include <charconv>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <csignal>
+#include <sys/inotify.h>
+#include <poll.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
-// Initialize server with port and verbose settings
-EventServer::EventServer(int port, bool verbose)
-    : port_(port), verbose_(verbose) {
+static const int    MAX_EPOLL_EVENTS = 64;
+static const size_t MAX_TOKEN_LEN    = 256;       // longest header token
+static const size_t MAX_HEADER_LEN   = MAX_TOKEN_LEN * 9 + 9; // command + 8 args
+static const size_t WAL_COMPACT_BYTES = 4u << 20; // compact early past 4 MiB
+static const size_t BODY_CHUNK       = 1u << 16;  // splice step (pipe size)
+static const size_t PIPELINE_MAX     = 1u << 16;  // buffered keep-alive input
+static const size_t MAX_REQUEST_FRAME = 512;      // longest binary request
+static const size_t UDP_DATAGRAM_MAX = 1024;      // longest UDP request read
+static const int    UDP_RCVBUF       = 4 << 20;   // absorbs login bursts
+static const time_t UDP_REPLY_TTL    = 30;        // retransmit window (s)
+static const size_t UDP_REPLY_MAX    = 8192;      // cached replies per reactor
+static const size_t UDP_LIST_PAGE    = 1000;      // LME/LMR datagram budget
+static const size_t UDP_LIST_TCP     = 8192;      // larger lists: use TCP
+static const char   UPLOAD_PREFIX[]  = "upload-";  // data/upload-XXXXXX
+static const char   STATE_FILE[]     = "data/state.bin";
+static const char* const SNAPSHOT_FILES[] = {  // text form, for -i/-x/-w
+    "users.txt", "events.txt", "reservations.txt"
+};
+
+// Identity of a file's current contents, to tell our writes from others'
+static string file_signature(const string& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return "";
+    return to_string(st.st_ino) + ":" + to_string(st.st_size) + ":" +
+           to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec);
+}
+
+// Parse two decimal digits at s[pos] (-1 if either is not a digit)
+static int two_digits(string_view s, size_t pos) {
+    if (pos + 1 >= s.size() || !isdigit(static_cast<unsigned char>(s[pos])) ||
+        !isdigit(static_cast<unsigned char>(s[pos + 1])))
+        return -1;
+    return (s[pos] - '0') * 10 + (s[pos + 1] - '0');
+}
+
+// Start of an event as epoch seconds, from "dd-mm-yyyy" and "hh:mm"
+// (read as UTC); 0 if the date is malformed
+static time_t event_start(string_view date, string_view time) {
+    if (date.size() != 10) return 0;
+    int dd = two_digits(date, 0), mm = two_digits(date, 3);
+    int yh = two_digits(date, 6), yl = two_digits(date, 8);
+    if (dd < 0 || mm < 0 || yh < 0 || yl < 0) return 0;
+
+    tm t{};
+    t.tm_mday = dd;
+    t.tm_mon  = mm - 1;
+    t.tm_year = yh * 100 + yl - 1900;
+    if (time.size() >= 5) {
+        t.tm_hour = max(0, two_digits(time, 0));
+        t.tm_min  = max(0, two_digits(time, 3));
+    }
+    return timegm(&t);
+}
+
+// Initialize server from the command-line options
+EventServer::EventServer(const ServerOptions& opts)
+    : port_(opts.port), verbose_(opts.verbose), threads_(opts.threads),
+      backlog_(opts.backlog), compact_secs_(opts.compact_secs),
+      watch_data_(opts.watch_data), import_text_(opts.import_text),
+      max_file_size_(opts.max_file_size), durability_(opts.durability),
+      flush_ms_(opts.flush_ms), flush_records_(opts.flush_records),
+      udp_batch_(max(1, opts.udp_batch)) {
+    for (int i = 0; i < max(1, opts.reactors); ++i) {
+        reactors_.push_back(make_unique<Reactor>());
+    }
     ensure_data_dir();
-    load_users();
-    load_events();
-    load_reservations();
+    timer_fd_ = ::timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) perror("timerfd_create");
+    wal_   = make_unique<WriteAheadLog>("data");
+    blobs_ = make_unique<BlobStore>("data/blobs");
+    file_cache_ = make_unique<FileCache>(
+        static_cast<size_t>(max(0L, opts.file_cache_mb)) << 20);
+    restore_state();
 }
 
-// Clean up socket resources
+// Stop the workers, then clean up socket resources
 EventServer::~EventServer() {
-    if (udp_sock_ >= 0) ::close(udp_sock_);
-    if (tcp_sock_ >= 0) ::close(tcp_sock_);
+    {
+        lock_guard<mutex> lk(compact_mtx_);
+        stopping_ = true;
+    }
+    compact_cv_.notify_all();
+    flush_cv_.notify_all();
+    if (compactor_.joinable()) compactor_.join();
+    if (watcher_.joinable()) watcher_.join();
+    if (flusher_.joinable()) flusher_.join();
+    if (durability_ != Durability::None) wal_->sync();
+
+    pool_.reset();
+    for (auto& r : reactors_) {
+        for (auto& kv : r->conns) ::close(kv.first);
+        if (r->udp_sock >= 0) ::close(r->udp_sock);
+        if (r->tcp_sock >= 0) ::close(r->tcp_sock);
+        if (r->wake_fd  >= 0) ::close(r->wake_fd);
+        if (r->epoll_fd >= 0) ::close(r->epoll_fd);
+    }
+    if (timer_fd_ >= 0) ::close(timer_fd_);
+    if (signal_fd_ >= 0) ::close(signal_fd_);
 }
 
-// Create data directory if it doesn't exist
+// Create data directory if it doesn't exist, and drop uploads left
+// behind by a crash mid-CRE and half-written files from a crash
+// mid-compaction
 void EventServer::ensure_data_dir() {
     struct stat st;
     if (stat("data", &st) != 0) {
         ::mkdir("data", 0755);
     }
+    size_t removed = 0;
+    if (DIR* d = ::opendir("data")) {
+        while (dirent* de = ::readdir(d)) {
+            string_view name = de->d_name;
+            size_t sfx = strlen(ATOMIC_TMP_SUFFIX);
+            bool upload  = name.substr(0, strlen(UPLOAD_PREFIX)) == UPLOAD_PREFIX;
+            bool partial = name.size() > sfx &&
+                           name.substr(name.size() - sfx) == ATOMIC_TMP_SUFFIX;
+            if ((upload || partial) &&
+                ::unlink((string("data/") + de->d_name).c_str()) == 0)
+                ++removed;
+        }
+        ::closedir(d);
+    }
+    if (removed && verbose_) {
+        cout << "[ES] Removed " << removed << " leftover temporary file(s)\n";
+    }
 }
 
-// Persist users to disk
-void EventServer::save_users() {
-    ofstream ofs("data/users.txt", ios::trunc);
-    if (!ofs) return;
-
-    for (const auto& u : users_) {
-        ofs << u.uid << " " << u.password << "\n";
+// Rebuild the tables: the snapshot (data/state.bin, or the data/*.txt
+// files when from_text), then the WAL on top. The caller holds every
+// table lock exclusively (or runs before any thread starts).
+size_t EventServer::load_state(bool from_text) {
+    clear_state();
+    uint64_t first = wal_->read_checkpoint();
+    if (from_text) {
+        load_users();
+        load_events();
+        load_reservations();
+    } else {
+        // A snapshot newer than the checkpoint (crash before compact()
+        // wrote it) already holds those segments: move the checkpoint up
+        uint64_t covered = load_snapshot(first);
+        if (covered > first) {
+            if (!wal_->write_checkpoint(covered)) die("[ES] write data/wal.checkpoint");
+            first = covered;
+        }
     }
+
+    size_t replayed = 0;
+    wal_->replay(first, [&](const WalRecord& rec) {
+        apply_record(rec);
+        ++replayed;
+    });
+    events_changed();
+    return replayed;
 }
 
-// Load users from disk and preserve login state
-void EventServer::load_users() {
-    vector<User> old = move(users_);
+// Empty every table and index
+void EventServer::clear_state() {
     users_.clear();
+    events_.clear();
+    events_by_owner_.clear();
+    {
+        lock_guard<mutex> lk(expiry_mtx_);
+        expiry_ = {};
+    }
+    blobs_->clear_refs();
+    reservations_.clear();
+    reservations_by_user_.clear();
+}
+
+// Startup: load the state and start a fresh WAL segment. The text files
+// are read on request (-i) or when there is no binary snapshot yet, and
+// are then folded into one straight away.
+void EventServer::restore_state() {
+    bool from_text = import_text_ || ::access(STATE_FILE, F_OK) != 0;
+    size_t replayed = load_state(from_text);
+    for (const char* name : SNAPSHOT_FILES) {
+        own_writes_[name] = file_signature(string("data/") + name);
+    }
+
+    uint64_t first = wal_->read_checkpoint();
+    wal_->remove_before(first);
+
+    vector<uint64_t> segs = wal_->segments();
+    uint64_t next = max<uint64_t>(first, 1);
+    if (!segs.empty()) next = max(next, segs.back() + 1);
+    if (!wal_->open_segment(next)) die("[ES] open WAL segment");
+
+    // Blobs stored by a CRE that crashed or failed before it was logged
+    size_t swept = blobs_->sweep();
+
+    if (verbose_) {
+        cout << "[ES] Loaded " << (from_text ? "data/*.txt" : STATE_FILE)
+             << ", replayed " << replayed << " WAL record(s)\n";
+        if (swept) cout << "[ES] Removed " << swept << " unreferenced blob(s)\n";
+    }
+
+    // -w edits the text files, so keep them current from the start
+    if (from_text || watch_data_) compact(true);
+}
+
+// Fill a data/state.bin record; false if a field does not fit its width.
+// Records are checked with these as they are imported or replayed, so
+// the tables only hold what a snapshot can store.
+static bool to_record(const User& u, snapshot::UserRecord& rec) {
+    rec = {};
+    return snapshot::put(rec.uid, u.uid) && snapshot::put(rec.password, u.password);
+}
+
+static bool to_record(const Event& ev, snapshot::EventRecord& rec) {
+    rec = {};
+    rec.fsize      = ev.fsize;
+    rec.attendance = ev.attendance;
+    rec.reserved   = ev.reserved;
+    rec.closed     = ev.closed ? 1 : 0;
+    return snapshot::put(rec.eid, ev.eid) &&
+           snapshot::put(rec.owner_uid, ev.owner_uid) &&
+           snapshot::put(rec.name, ev.name) &&
+           snapshot::put(rec.date, ev.date) &&
+           snapshot::put(rec.time, ev.time) &&
+           snapshot::put(rec.fname, ev.fname) &&
+           snapshot::put(rec.blob, ev.blob);
+}
+
+static bool to_record(const Reservation& r, snapshot::ReservationRecord& rec) {
+    rec = {};
+    rec.seats = r.seats;
+    return snapshot::put(rec.uid, r.uid) && snapshot::put(rec.eid, r.eid) &&
+           snapshot::put(rec.timestamp, r.timestamp);
+}
+
+static bool fits_snapshot(const User& u) {
+    snapshot::UserRecord rec;
+    return to_record(u, rec);
+}
+
+static bool fits_snapshot(const Event& ev) {
+    snapshot::EventRecord rec;
+    return to_record(ev, rec);
+}
+
+static bool fits_snapshot(const Reservation& r) {
+    snapshot::ReservationRecord rec;
+    return to_record(r, rec);
+}
+
+// Users table in data/users.txt format (caller holds users_mtx_)
+string EventServer::dump_users() const {
+    ostringstream ofs;
+    users_.for_each([&](const User& u) {
+        ofs << u.uid << " " << u.password << "\n";
+    });
+    return ofs.str();
+}
 
+// Users table as data/state.bin records (caller holds users_mtx_)
+void EventServer::pack_users(string& out, uint64_t& count) const {
+    users_.for_each([&](const User& u) {
+        snapshot::UserRecord rec;
+        if (!to_record(u, rec)) {
+            cerr << "[ES] snapshot: skipping user " << u.uid << " (field too long)\n";
+            return;
+        }
+        out.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+        ++count;
+    });
+}
+
+void EventServer::load_users() {
     ifstream ifs("data/users.txt");
     if (!ifs) return;
 
@@ -66,24 +320,19 @@ void EventServer::load_users() {
         u.uid       = uid;
         u.password  = pass;
         u.loggedIn  = false;
-
-        // Restore login state if user existed
-        for (const auto& ou : old) {
-            if (ou.uid == u.uid) {
-                u.loggedIn = ou.loggedIn;
-                break;
-            }
+        if (!fits_snapshot(u)) {
+            cerr << "[ES] data/users.txt: skipping user " << uid << " (field too long)\n";
+            continue;
         }
-
-        users_.push_back(move(u));
+        users_.insert(uid, move(u));
     }
 }
 
-void EventServer::save_events() {
-    ofstream ofs("data/events.txt", ios::trunc);
-    if (!ofs) return;
-
-    for (const auto& ev : events_) {
+// Events table in data/events.txt format (caller holds events_mtx_)
+string EventServer::dump_events() const {
+    ostringstream ofs;
+    events_.for_each([&](const Event& ev) {
+        lock_guard<mutex> el(event_lock(ev.eid));
         ofs << ev.eid        << " "
             << ev.owner_uid  << " "
             << ev.name       << " "
@@ -93,48 +342,192 @@ void EventServer::save_events() {
             << ev.reserved   << " "
             << (ev.closed ? 1 : 0) << " "
             << ev.fname      << " "
-            << ev.fsize      << "\n";
-    }
+            << ev.fsize      << " "
+            << (ev.blob.empty() ? "-" : ev.blob) << "\n";
+    });
+    return ofs.str();
 }
 
-void EventServer::save_reservations() {
-    ofstream ofs("data/reservations.txt", ios::trunc);
-    if (!ofs) return;
+// Events table as data/state.bin records (caller holds events_mtx_)
+void EventServer::pack_events(string& out, uint64_t& count) const {
+    events_.for_each([&](const Event& ev) {
+        lock_guard<mutex> el(event_lock(ev.eid));
+        snapshot::EventRecord rec;
+        if (!to_record(ev, rec)) {
+            cerr << "[ES] snapshot: skipping event " << ev.eid << " (field too long)\n";
+            return;
+        }
+        out.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+        ++count;
+    });
+}
 
+// Reservations in data/reservations.txt format (caller holds reservations_mtx_)
+string EventServer::dump_reservations() const {
+    ostringstream ofs;
     for (const auto& r : reservations_) {
         ofs << r.uid << " "
             << r.eid << " "
             << r.seats << " "
             << r.timestamp << "\n";
     }
+    return ofs.str();
 }
 
-void EventServer::load_events() {
-    events_.clear();
+// Reservations as data/state.bin records (caller holds reservations_mtx_)
+void EventServer::pack_reservations(string& out, uint64_t& count) const {
+    for (const auto& r : reservations_) {
+        snapshot::ReservationRecord rec;
+        if (!to_record(r, rec)) {
+            cerr << "[ES] snapshot: skipping reservation of " << r.uid << " for "
+                 << r.eid << " (field too long)\n";
+            continue;
+        }
+        out.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+        ++count;
+    }
+}
 
+// Add a loaded event with its index, expiry and blob reference
+void EventServer::restore_event(Event ev) {
+    ev.start = event_start(ev.date, ev.time);
+    string eid = ev.eid;
+    if (Event* e = events_.insert(eid, move(ev))) {
+        index_event(*e);
+        schedule_expiry(*e);
+        if (!e->blob.empty()) blobs_->add_ref(e->blob);
+    }
+}
+
+// Load data/state.bin: map it, then check the header and decode the
+// records in a single pass that also computes the CRC. A snapshot that
+// fails any check stops the server rather than serving partial state.
+// Returns the first WAL segment to replay on top of it: the header's
+// wal_next, or checkpoint when there is no file.
+uint64_t EventServer::load_snapshot(uint64_t checkpoint) {
+    int fd = ::open(STATE_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return checkpoint;
+        perror("[ES] open data/state.bin");
+        exit(1);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        perror("[ES] stat data/state.bin");
+        exit(1);
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    const char* base = nullptr;
+    if (size > 0) {
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            perror("[ES] mmap data/state.bin");
+            exit(1);
+        }
+        base = static_cast<const char*>(p);
+        ::madvise(p, size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+
+    auto corrupt = [&](const char* why) {
+        cerr << "[ES] data/state.bin is unusable (" << why << "); restore it from a backup\n";
+        exit(1);
+    };
+
+    using namespace snapshot;
+    if (size < sizeof(Header)) corrupt("truncated header");
+    const Header* h = reinterpret_cast<const Header*>(base);
+    if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0) corrupt("bad magic");
+    if (h->version != VERSION) corrupt("unsupported version");
+    // The checkpoint is written only after the snapshot is in place, so
+    // it can lag behind wal_next (crash in between) but never pass it
+    if (h->wal_next < checkpoint) corrupt("older than data/wal.checkpoint");
+    uint64_t wal_next = h->wal_next;
+    size_t body = size - sizeof(Header);
+    if (h->users > body / sizeof(UserRecord) ||
+        h->events > body / sizeof(EventRecord) ||
+        h->reservations > body / sizeof(ReservationRecord) ||
+        h->users * sizeof(UserRecord) + h->events * sizeof(EventRecord) +
+            h->reservations * sizeof(ReservationRecord) != body)
+        corrupt("size does not match the record counts");
+
+    uint32_t crc = 0;
+    const char* p = base + sizeof(Header);
+    for (uint64_t i = 0; i < h->users; ++i, p += sizeof(UserRecord)) {
+        crc = crc32(p, sizeof(UserRecord), crc);
+        const auto* rec = reinterpret_cast<const UserRecord*>(p);
+        User u;
+        u.uid      = string(get(rec->uid));
+        u.password = string(get(rec->password));
+        users_.insert(get(rec->uid), move(u));
+    }
+    for (uint64_t i = 0; i < h->events; ++i, p += sizeof(EventRecord)) {
+        crc = crc32(p, sizeof(EventRecord), crc);
+        const auto* rec = reinterpret_cast<const EventRecord*>(p);
+        Event ev;
+        ev.eid        = string(get(rec->eid));
+        ev.owner_uid  = string(get(rec->owner_uid));
+        ev.name       = string(get(rec->name));
+        ev.date       = string(get(rec->date));
+        ev.time       = string(get(rec->time));
+        ev.attendance = rec->attendance;
+        ev.reserved   = rec->reserved;
+        ev.closed     = rec->closed != 0;
+        ev.fname      = string(get(rec->fname));
+        ev.fsize      = static_cast<unsigned long>(rec->fsize);
+        ev.blob       = string(get(rec->blob));
+        restore_event(move(ev));
+    }
+    for (uint64_t i = 0; i < h->reservations; ++i, p += sizeof(ReservationRecord)) {
+        crc = crc32(p, sizeof(ReservationRecord), crc);
+        const auto* rec = reinterpret_cast<const ReservationRecord*>(p);
+        Reservation r;
+        r.uid       = string(get(rec->uid));
+        r.eid       = string(get(rec->eid));
+        r.seats     = rec->seats;
+        r.timestamp = string(get(rec->timestamp));
+        add_reservation(move(r));
+    }
+    bool crc_ok = crc == h->crc;
+    if (base) ::munmap(const_cast<char*>(base), size);
+    if (!crc_ok) corrupt("checksum mismatch");
+    return wal_next;
+}
+
+void EventServer::load_events() {
     ifstream ifs("data/events.txt");
     if (!ifs) return;
 
-    Event ev;
-    int closed_int = 0;
-    while (ifs >> ev.eid
-               >> ev.owner_uid
-               >> ev.name
-               >> ev.date
-               >> ev.time
-               >> ev.attendance
-               >> ev.reserved
-               >> closed_int
-               >> ev.fname
-               >> ev.fsize) {
+    string line;
+    while (getline(ifs, line)) {
+        istringstream iss(line);
+        Event ev;
+        int closed_int = 0;
+        if (!(iss >> ev.eid
+                  >> ev.owner_uid
+                  >> ev.name
+                  >> ev.date
+                  >> ev.time
+                  >> ev.attendance
+                  >> ev.reserved
+                  >> closed_int
+                  >> ev.fname
+                  >> ev.fsize)) {
+            continue;
+        }
+        // Blob key; missing or '-' for events stored before the blob store
+        if (!(iss >> ev.blob) || ev.blob == "-") ev.blob.clear();
+
         ev.closed = (closed_int != 0);
-        events_.push_back(ev);
+        if (!fits_snapshot(ev)) {
+            cerr << "[ES] data/events.txt: skipping event " << ev.eid << " (field too long)\n";
+            continue;
+        }
+        restore_event(move(ev));
     }
 }
 
 void EventServer::load_reservations() {
-    reservations_.clear();
-
     ifstream ifs("data/reservations.txt");
     if (!ifs) return;
 
@@ -154,87 +547,509 @@ void EventServer::load_reservations() {
             rest.erase(0, 1);
 
         r.timestamp = rest;
-        reservations_.push_back(r);
+        if (!fits_snapshot(r)) {
+            cerr << "[ES] data/reservations.txt: skipping reservation of " << r.uid
+                 << " for " << r.eid << " (field too long)\n";
+            continue;
+        }
+        add_reservation(move(r));
+    }
+}
+
+// --- write-ahead log ---
+
+// LSN of the last mutation logged by the request this thread is running;
+// its reply is held until that record is durable (see await_durable)
+static thread_local uint64_t pending_lsn = 0;
+
+static uint64_t take_pending_lsn() {
+    uint64_t lsn = pending_lsn;
+    pending_lsn = 0;
+    return lsn;
+}
+
+// Append a mutation to the WAL. Callers hold wal_gate_ (shared) and the
+// lock that orders the mutation, so the log matches in-memory order.
+// False if it could not be written: the caller leaves the state as it
+// was and reports failure.
+bool EventServer::log_mutation(const WalRecord& rec) {
+    uint64_t lsn;
+    size_t   size;
+    if (!wal_->append(rec, lsn, size)) return false;
+    if (size >= WAL_COMPACT_BYTES) {
+        {
+            lock_guard<mutex> lk(compact_mtx_);
+            compact_requested_ = true;
+        }
+        compact_cv_.notify_one();
+    }
+    pending_lsn = lsn;
+
+    // Batched: a full group is flushed without waiting for the timer
+    if (durability_ == Durability::Batched &&
+        lsn - wal_->durable() >= static_cast<uint64_t>(flush_records_)) {
+        {
+            lock_guard<mutex> lk(flush_mtx_);
+            flush_requested_ = true;
+        }
+        flush_cv_.notify_one();
+    }
+    return true;
+}
+
+// After a request has run (its locks released): true if its reply may go
+// out now. Strict syncs here; batched parks the connection on r until
+// the flusher's next sync covers it.
+bool EventServer::await_durable(Reactor& r, int fd) {
+    uint64_t lsn = take_pending_lsn();
+    if (lsn == 0 || durability_ == Durability::None) return true;
+    if (durability_ == Durability::Strict) {
+        wal_->sync_to(lsn);
+        return true;
+    }
+    lock_guard<mutex> lk(r.done_mtx); // pairs with release_parked
+    if (wal_->durable() >= lsn) return true;
+    r.parked_fds.emplace_back(lsn, fd);
+    return false;
+}
+
+// Whether the UDP reply a handler queued may be sent with the rest of
+// its batch. Batched parks it until durable (as for TCP); strict raises
+// sync_lsn, which the batch syncs once before sending.
+bool EventServer::udp_reply_ready(Reactor& r, UdpPeer& peer, uint64_t lsn,
+                                  uint64_t& sync_lsn) {
+    if (peer.reply.empty()) return false;
+    if (lsn != 0 && durability_ == Durability::Strict) {
+        sync_lsn = max(sync_lsn, lsn);
+    } else if (lsn != 0 && durability_ == Durability::Batched) {
+        lock_guard<mutex> lk(r.done_mtx);
+        if (wal_->durable() < lsn) {
+            r.parked_udp.emplace_back(lsn, move(peer));
+            return false;
+        }
+    }
+    if (verbose_) {
+        cout << "[ES][UDP] Sent: \"" << peer.reply << "\"\n";
+    }
+    return true;
+}
+
+// Request ID of a UDP request: a trailing "#<digits>" token (0 if none)
+static uint32_t udp_request_id(string_view msg) {
+    size_t end = msg.find_last_not_of(" \t\r\n");
+    if (end == string_view::npos) return 0;
+    size_t start = msg.find_last_of(" \t", end);
+    start = start == string_view::npos ? 0 : start + 1;
+    if (msg[start] != '#') return 0;
+
+    uint32_t rid = 0;
+    const char* first = msg.data() + start + 1;
+    const char* last  = msg.data() + end + 1;
+    auto [ptr, ec] = from_chars(first, last, rid);
+    if (first == last || ec != errc() || ptr != last) return 0;
+    return rid;
+}
+
+static UdpReplyCache::Key reply_key(const UdpPeer& peer, uint32_t rid) {
+    return {peer.addr.sin_addr.s_addr, peer.addr.sin_port, rid};
+}
+
+// A retransmission of a request already run: true if it is dealt with,
+// by queueing the cached reply (once durable) or dropping the duplicate
+// while the original reply still waits for its fsync
+bool EventServer::answer_retransmit(Reactor& r, UdpPeer& peer, uint32_t rid) {
+    auto it = r.reply_cache.entries.find(reply_key(peer, rid));
+    if (it == r.reply_cache.entries.end()) return false;
+    if (it->second.lsn == 0 || wal_->durable() >= it->second.lsn) {
+        peer.reply = it->second.reply;
+    }
+    return true;
+}
+
+// Cache the reply to a request carrying an ID, dropping expired entries
+void EventServer::remember_reply(Reactor& r, const UdpPeer& peer,
+                                 uint32_t rid, uint64_t lsn) {
+    UdpReplyCache& cache = r.reply_cache;
+    time_t now = ::time(nullptr);
+    while (!cache.order.empty() &&
+           (cache.order.front().first + UDP_REPLY_TTL <= now ||
+            cache.order.size() >= UDP_REPLY_MAX)) {
+        cache.entries.erase(cache.order.front().second);
+        cache.order.pop_front();
+    }
+    UdpReplyCache::Key key = reply_key(peer, rid);
+    if (cache.entries.emplace(key, UdpReplyCache::Entry{peer.reply, lsn}).second) {
+        cache.order.emplace_back(now, key);
+    }
+}
+
+// Send UDP replies with as few sendmmsg calls as the socket allows. A
+// reply the kernel refuses is dropped, as a lost datagram would be.
+static void send_udp_replies(int sock, vector<UdpPeer>& replies) {
+    vector<mmsghdr> msgs(replies.size());
+    vector<iovec>   iov(replies.size());
+    for (size_t i = 0; i < replies.size(); ++i) {
+        iov[i].iov_base = const_cast<char*>(replies[i].reply.data());
+        iov[i].iov_len  = replies[i].reply.size();
+        msgs[i].msg_hdr = {};
+        msgs[i].msg_hdr.msg_name    = &replies[i].addr;
+        msgs[i].msg_hdr.msg_namelen = replies[i].len;
+        msgs[i].msg_hdr.msg_iov     = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen  = 1;
+    }
+    size_t off = 0;
+    while (off < msgs.size()) {
+        int n = ::sendmmsg(sock, msgs.data() + off,
+                           static_cast<unsigned>(msgs.size() - off), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ++off; // skip the reply that failed
+        } else {
+            off += static_cast<size_t>(n);
+        }
+    }
+}
+
+// Let out every parked reply the WAL now covers: UDP replies are sent
+// from here, TCP connections are handed back to their reactor
+void EventServer::release_parked() {
+    uint64_t durable = wal_->durable();
+    for (auto& rp : reactors_) {
+        Reactor& r = *rp;
+        vector<UdpPeer> ready;
+        bool wake = false;
+        {
+            lock_guard<mutex> lk(r.done_mtx);
+            auto fds = partition(r.parked_fds.begin(), r.parked_fds.end(),
+                                 [&](const auto& p) { return p.first > durable; });
+            for (auto it = fds; it != r.parked_fds.end(); ++it) {
+                r.done_fds.push_back(it->second);
+                wake = true;
+            }
+            r.parked_fds.erase(fds, r.parked_fds.end());
+
+            auto udp = partition(r.parked_udp.begin(), r.parked_udp.end(),
+                                 [&](const auto& p) { return p.first > durable; });
+            for (auto it = udp; it != r.parked_udp.end(); ++it) {
+                ready.push_back(move(it->second));
+            }
+            r.parked_udp.erase(udp, r.parked_udp.end());
+        }
+        if (!ready.empty()) send_udp_replies(r.udp_sock, ready);
+        if (wake) {
+            uint64_t one = 1;
+            ssize_t w = ::write(r.wake_fd, &one, sizeof(one));
+            (void)w;
+        }
+    }
+}
+
+// Background thread (-d batched): group commit every flush_ms_, or
+// sooner once flush_records_ records are waiting
+void EventServer::flusher_loop() {
+    unique_lock<mutex> lk(flush_mtx_);
+    while (!stopping_) {
+        flush_cv_.wait_for(lk, chrono::milliseconds(flush_ms_),
+                           [this] { return stopping_ || flush_requested_; });
+        flush_requested_ = false;
+        lk.unlock();
+        wal_->sync();
+        release_parked(); // also what a compaction's rotation synced
+        lk.lock();
+    }
+}
+
+// Re-apply one logged mutation while loading state (see load_state)
+void EventServer::apply_record(const WalRecord& rec) {
+    const vector<string>& f = rec.fields;
+    // A field too long for data/state.bin would stop every compaction
+    auto too_long = [&] {
+        cerr << "[ES] WAL: skipping a '" << static_cast<char>(rec.op) << "' record for "
+             << (f.empty() ? string("?") : f[0]) << " (field too long)\n";
+    };
+    try {
+        switch (rec.op) {
+        case WalOp::UserRegistered:
+        case WalOp::PasswordChanged: {
+            if (f.size() < 2) return;
+            User nu;
+            nu.uid      = f[0];
+            nu.password = f[1];
+            if (!fits_snapshot(nu)) return too_long();
+            if (User* u = find_user(f[0])) {
+                u->password = f[1];
+            } else if (rec.op == WalOp::UserRegistered) {
+                users_.insert(nu.uid, nu);
+            }
+            break;
+        }
+        case WalOp::UserRemoved: {
+            if (f.empty()) return;
+            users_.erase(f[0]);
+            break;
+        }
+        case WalOp::EventCreated: {
+            if (f.size() < 8) return;
+            if (find_event(f[0])) return;
+            Event ev;
+            ev.eid        = f[0];
+            ev.owner_uid  = f[1];
+            ev.name       = f[2];
+            ev.date       = f[3];
+            ev.time       = f[4];
+            ev.attendance = stoi(f[5]);
+            ev.fname      = f[6];
+            ev.fsize      = stoul(f[7]);
+            if (f.size() > 8) ev.blob = f[8];
+            if (!fits_snapshot(ev)) return too_long();
+            restore_event(move(ev));
+            break;
+        }
+        case WalOp::EventClosed: {
+            if (f.empty()) return;
+            if (Event* ev = find_event(f[0])) ev->closed = true;
+            break;
+        }
+        case WalOp::SeatsReserved: {
+            if (f.size() < 5) return;
+            Reservation r;
+            r.uid       = f[0];
+            r.eid       = f[1];
+            r.seats     = stoi(f[2]);
+            r.timestamp = f[3] + " " + f[4];
+            if (!fits_snapshot(r)) return too_long();
+            if (Event* ev = find_event(r.eid)) ev->reserved += r.seats;
+            add_reservation(move(r));
+            break;
+        }
+        }
+    } catch (...) {
+        // Malformed numeric field: skip the record
+    }
+}
+
+// Fold the WAL into data/state.bin. Mutations are paused only while
+// the tables are copied and the log is rotated; the file is written
+// afterwards, atomically and recording in its header the first segment
+// it does not cover. The checkpoint is written next and the covered
+// segments deleted once it is on disk. A crash before the rename leaves
+// the old snapshot with the old checkpoint; a crash after it leaves a
+// checkpoint behind the snapshot, which load_state moves up to the
+// header's value instead of replaying covered segments twice.
+// Forced compactions run even with an empty log and also rewrite the
+// data/*.txt files (startup import, -x export, -w reloads), as does
+// every compaction under -w.
+void EventServer::compact(bool force) {
+    lock_guard<mutex> snap(snapshot_mtx_);
+    bool text = force || watch_data_;
+    string users, events, reservations;
+    string users_txt, events_txt, reservations_txt;
+    uint64_t nusers = 0, nevents = 0, nreservations = 0;
+    uint64_t next;
+    {
+        unique_lock<shared_mutex> gate(wal_gate_);
+        if (!force && wal_->current_size() == 0) return;
+        {
+            shared_lock<shared_mutex> lk(users_mtx_);
+            pack_users(users, nusers);
+            if (text) users_txt = dump_users();
+        }
+        {
+            shared_lock<shared_mutex> lk(events_mtx_);
+            pack_events(events, nevents);
+            if (text) events_txt = dump_events();
+        }
+        {
+            lock_guard<mutex> lk(reservations_mtx_);
+            pack_reservations(reservations, nreservations);
+            if (text) reservations_txt = dump_reservations();
+        }
+        // Without a new segment the snapshot would cover records still
+        // being appended to the old one
+        next = wal_->rotate();
+        if (next == 0) {
+            cerr << "[ES] snapshot: could not open a new WAL segment;"
+                    " keeping the WAL\n";
+            return;
+        }
+    }
+
+    string state = snapshot::assemble(users, nusers, events, nevents,
+                                      reservations, nreservations, next);
+    if (!write_file_atomic(STATE_FILE, state) ||
+        (text && (!write_file_atomic("data/users.txt", users_txt) ||
+                  !write_file_atomic("data/events.txt", events_txt) ||
+                  !write_file_atomic("data/reservations.txt", reservations_txt))) ||
+        !wal_->write_checkpoint(next)) {
+        perror("[ES] snapshot");
+        return;
+    }
+    wal_->remove_before(next);
+    for (const char* name : SNAPSHOT_FILES) {
+        own_writes_[name] = file_signature(string("data/") + name);
+    }
+
+    if (verbose_) {
+        cout << "[ES] Compacted WAL into snapshot (next segment "
+             << next << ")\n";
+    }
+}
+
+// -x: fold the WAL into data/state.bin and write the text files too
+void EventServer::export_text() {
+    compact(true);
+    cout << "[ES] Exported state to data/users.txt, data/events.txt and"
+            " data/reservations.txt\n";
+}
+
+// Re-read the text snapshot files (and the WAL on top) after an external
+// edit. Login state is not persisted, so it is carried across.
+void EventServer::reload_state() {
+    lock_guard<mutex>          snap(snapshot_mtx_);
+    unique_lock<shared_mutex>  gate(wal_gate_);
+    unique_lock<shared_mutex>  ul(users_mtx_);
+    unique_lock<shared_mutex>  el(events_mtx_);
+    lock_guard<mutex>          rl(reservations_mtx_);
+
+    vector<string> logged_in;
+    users_.for_each([&](const User& u) {
+        if (u.loggedIn) logged_in.push_back(u.uid);
+    });
+
+    load_state(true);
+    file_cache_->clear();
+
+    for (const string& uid : logged_in) {
+        if (User* u = find_user(uid)) u->loggedIn = true;
+    }
+
+    if (verbose_) {
+        cout << "[ES] Reloaded data/ after external change\n";
+    }
+}
+
+// Background thread (-w): reload when a snapshot file is replaced or
+// rewritten by something other than our own compaction
+void EventServer::watch_loop() {
+    int ifd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd < 0) {
+        perror("inotify_init1");
+        return;
+    }
+    if (::inotify_add_watch(ifd, "data", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("inotify_add_watch");
+        ::close(ifd);
+        return;
+    }
+
+    alignas(inotify_event) char buf[4096];
+    while (!stopping_) {
+        pollfd pfd{ifd, POLLIN, 0};
+        if (::poll(&pfd, 1, 500) <= 0) continue;
+
+        // Collect a burst of events (editors write in several steps)
+        bool relevant = false;
+        do {
+            ssize_t n;
+            while ((n = ::read(ifd, buf, sizeof(buf))) > 0) {
+                for (char* p = buf; p < buf + n; ) {
+                    auto* ev = reinterpret_cast<inotify_event*>(p);
+                    for (const char* name : SNAPSHOT_FILES) {
+                        if (ev->len && strcmp(ev->name, name) == 0)
+                            relevant = true;
+                    }
+                    p += sizeof(inotify_event) + ev->len;
+                }
+            }
+        } while (::poll(&pfd, 1, 100) > 0);
+        if (!relevant) continue;
+
+        bool external = false;
+        {
+            lock_guard<mutex> snap(snapshot_mtx_);
+            for (const char* name : SNAPSHOT_FILES) {
+                if (own_writes_[name] != file_signature(string("data/") + name))
+                    external = true;
+            }
+        }
+        if (external) {
+            reload_state();
+            compact(true); // so a restart sees the edit in data/state.bin
+        }
+    }
+    ::close(ifd);
+}
+
+// Background thread: compact periodically, or early when the log grows
+void EventServer::compactor_loop() {
+    unique_lock<mutex> lk(compact_mtx_);
+    while (!stopping_) {
+        compact_cv_.wait_for(lk, chrono::seconds(compact_secs_),
+                             [this] { return stopping_ || compact_requested_; });
+        if (stopping_) break;
+        compact_requested_ = false;
+        lk.unlock();
+        compact();
+        lk.lock();
     }
 }
 
 // Check if UID is 6 digits
-bool EventServer::valid_uid(const string& uid) const {
+bool EventServer::valid_uid(string_view uid) const {
     if (uid.size() != 6) return false;
     return all_of(uid.begin(), uid.end(),
                        [](unsigned char c){ return isdigit(c); });
 }
 
 // Check if password is 8 alphanumeric characters
-bool EventServer::valid_password(const string& pass) const {
+bool EventServer::valid_password(string_view pass) const {
     if (pass.size() != 8) return false;
     return all_of(pass.begin(), pass.end(),
                        [](unsigned char c){ return isalnum(c); });
 }
 
 // Check if event name is alphanumeric and max 10 chars
-bool EventServer::valid_event_name(const string& name) const {
+bool EventServer::valid_event_name(string_view name) const {
     if (name.empty() || name.size() > 10) return false;
     return all_of(name.begin(), name.end(),
                        [](unsigned char c){ return isalnum(c); });
 }
 
-// Validate date (dd-mm-yyyy) and time (hh:mm) format
-bool EventServer::valid_event_datetime(const string& date,
-                                       const string& time) const {
+// Validate date format (dd-mm-yyyy)
+bool EventServer::valid_event_date(string_view date) const {
     if (date.size() != 10) return false;
     if (date[2] != '-' || date[5] != '-') return false;
-    string dd = date.substr(0, 2);
-    string mm = date.substr(3, 2);
-    string yyyy = date.substr(6, 4);
-    if (!all_of(dd.begin(), dd.end(), ::isdigit)) return false;
-    if (!all_of(mm.begin(), mm.end(), ::isdigit)) return false;
-    if (!all_of(yyyy.begin(), yyyy.end(), ::isdigit)) return false;
-
-    int d = stoi(dd);
-    int m = stoi(mm);
-    int y = stoi(yyyy);
+    int d = two_digits(date, 0);
+    int m = two_digits(date, 3);
+    if (two_digits(date, 6) < 0 || two_digits(date, 8) < 0) return false;
     if (m < 1 || m > 12) return false;
     if (d < 1 || d > 31) return false;
+    return true;
+}
 
+// Validate time format (hh:mm, or hh:mm:ss with the seconds unchecked)
+bool EventServer::valid_event_time(string_view time) const {
     if (time.size() != 5 && time.size() != 8) return false;
     if (time[2] != ':') return false;
-    string hh = time.substr(0, 2);
-    string mi = time.substr(3, 2);
-    if (!all_of(hh.begin(), hh.end(), ::isdigit)) return false;
-    if (!all_of(mi.begin(), mi.end(), ::isdigit)) return false;
-    int H = stoi(hh);
-    int M = stoi(mi);
+    int H = two_digits(time, 0);
+    int M = two_digits(time, 3);
     if (H < 0 || H > 23) return false;
     if (M < 0 || M > 59) return false;
-    (void)y;
     return true;
 }
 
-// Compute event state: 0=past, 1=open, 2=sold out, 3=closed
-int EventServer::compute_event_state(const Event& ev) const {
-    tm tm{};
-    if (ev.date.size() != 10) return 0;
-    string dd = ev.date.substr(0, 2);
-    string mm = ev.date.substr(3, 2);
-    string yyyy = ev.date.substr(6, 4);
-    string hh = "00";
-    string mi = "00";
-    if (ev.time.size() >= 5) {
-        hh = ev.time.substr(0, 2);
-        mi = ev.time.substr(3, 2);
-    }
-    tm.tm_mday = stoi(dd);
-    tm.tm_mon  = stoi(mm) - 1;
-    tm.tm_year = stoi(yyyy) - 1900;
-    tm.tm_hour = stoi(hh);
-    tm.tm_min  = stoi(mi);
-    tm.tm_sec  = 0;
-
-    time_t event_time = timegm(&tm);
+// Check if file name is at most 24 alphanumeric, '-', '_' or '.' chars
+bool EventServer::valid_file_name(string_view fname) const {
+    if (fname.empty() || fname.size() > 24) return false;
+    return all_of(fname.begin(), fname.end(), [](unsigned char c) {
+        return isalnum(c) || c == '-' || c == '_' || c == '.';
+    });
+}
 
-    time_t now = time(nullptr);
-    if (event_time <= now) {
+// State code of an event: 0 past, 1 open, 2 sold out, 3 closed.
+// Caller holds the event's lock; 'past' is kept current by expire_events.
+int EventServer::compute_event_state(const Event& ev) const {
+    if (ev.past) {
         return 0;
     }
     if (ev.closed) {
@@ -246,166 +1061,391 @@ int EventServer::compute_event_state(const Event& ev) const {
     return 1;
 }
 
-User* EventServer::find_user(const string& uid) {
-    for (auto& u : users_) {
-        if (u.uid == uid) return &u;
+User* EventServer::find_user(string_view uid) {
+    return users_.find(uid);
+}
+
+Event* EventServer::find_event(string_view eid) {
+    return events_.find(eid);
+}
+
+// File a new event under its owner, keeping the owner's EIDs sorted
+// (caller holds events_mtx_ exclusively)
+void EventServer::index_event(const Event& ev) {
+    vector<string>& eids = events_by_owner_[ev.owner_uid];
+    eids.insert(lower_bound(eids.begin(), eids.end(), ev.eid), ev.eid);
+}
+
+// Append a reservation and file it under its user, ordered by
+// (EID, timestamp) (caller holds reservations_mtx_)
+void EventServer::add_reservation(Reservation r) {
+    size_t idx = reservations_.size();
+    reservations_.push_back(move(r));
+    const Reservation& nr = reservations_.back();
+
+    vector<size_t>& mine = reservations_by_user_[nr.uid];
+    auto pos = upper_bound(mine.begin(), mine.end(), idx,
+                           [&](size_t a, size_t b) {
+                               const Reservation& x = reservations_[a];
+                               const Reservation& y = reservations_[b];
+                               if (x.eid != y.eid) return x.eid < y.eid;
+                               return x.timestamp < y.timestamp;
+                           });
+    mine.insert(pos, idx);
+}
+
+// Invalidate the cached LST reply. Call after the change is made, still
+// under the lock that guards it, so a reply built concurrently is either
+// current or tagged with an older version.
+void EventServer::events_changed() {
+    events_version_.fetch_add(1, memory_order_release);
+}
+
+// --- event expiry ---
+
+// Mark ev past now, or queue it for expire_events (caller holds
+// events_mtx_ exclusively)
+void EventServer::schedule_expiry(Event& ev) {
+    if (ev.start <= ::time(nullptr)) {
+        ev.past = true;
+        return;
     }
-    return nullptr;
+    lock_guard<mutex> lk(expiry_mtx_);
+    bool earliest = expiry_.empty() || ev.start < expiry_.top().first;
+    expiry_.emplace(ev.start, ev.eid);
+    if (earliest) arm_expiry_timer();
 }
 
-Event* EventServer::find_event(const string& eid) {
-    for (auto& ev : events_) {
-        if (ev.eid == eid) return &ev;
+// Point the timerfd at the earliest pending start (caller holds expiry_mtx_)
+void EventServer::arm_expiry_timer() {
+    if (timer_fd_ < 0) return;
+    itimerspec its{};
+    if (!expiry_.empty()) its.it_value.tv_sec = expiry_.top().first;
+    ::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+
+// Timer fired (reactor 0): flip every event whose start has passed
+void EventServer::expire_events() {
+    uint64_t ticks;
+    while (::read(timer_fd_, &ticks, sizeof(ticks)) > 0) {}
+
+    shared_lock<shared_mutex> el(events_mtx_);
+    lock_guard<mutex>         lk(expiry_mtx_);
+    time_t now = ::time(nullptr);
+    while (!expiry_.empty() && expiry_.top().first <= now) {
+        auto [start, eid] = expiry_.top();
+        expiry_.pop();
+        Event* ev = find_event(eid);
+        if (!ev || ev->start != start) continue; // replaced by a reload
+        lock_guard<mutex> evl(event_lock(eid));
+        ev->past = true;
+        events_changed();
+    }
+    arm_expiry_timer();
+}
+
+// Lock guarding the seat count and closed flag of one event
+mutex& EventServer::event_lock(string_view eid) const {
+    size_t idx = 0;
+    for (char ch : eid) {
+        if (isdigit(static_cast<unsigned char>(ch)))
+            idx = (idx * 10 + static_cast<size_t>(ch - '0')) % event_locks_.size();
     }
-    return nullptr;
+    return event_locks_[idx];
 }
 
 // Find next available event ID (001-999)
 string EventServer::allocate_eid() {
-    bool used[1000] = {false};
-    for (const auto& ev : events_) {
-        if (ev.eid.size() == 3 &&
-            all_of(ev.eid.begin(), ev.eid.end(), ::isdigit)) {
-            int x = stoi(ev.eid);
-            if (x >= 1 && x <= 999) used[x] = true;
-        }
-    }
-    for (int i = 1; i <= 999; ++i) {
-        if (!used[i]) {
+    for (long i = 1; i <= 999; ++i) {
+        if (!events_.at(i)) {
             char buf[4];
-            snprintf(buf, sizeof(buf), "%03d", i);
+            snprintf(buf, sizeof(buf), "%03ld", i);
             return string(buf);
         }
     }
     return "";
 }
 
-// Initialize and bind UDP and TCP sockets
-bool EventServer::init_sockets() {
+// Create one reactor's UDP and TCP sockets plus its epoll instance.
+// With several reactors every socket sets SO_REUSEPORT so the kernel
+// spreads datagrams and connections across them.
+bool EventServer::init_reactor(Reactor& r) {
+    int opt = 1;
+    bool reuseport = reactors_.size() > 1;
+
     // UDP
-    udp_sock_ = ::socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_sock_ < 0) {
+    r.udp_sock = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (r.udp_sock < 0) {
         perror("socket UDP");
         return false;
     }
+    if (reuseport &&
+        ::setsockopt(r.udp_sock, SOL_SOCKET, SO_REUSEPORT,
+                     &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT (UDP)");
+        return false;
+    }
 
     sockaddr_in servaddr{};
     servaddr.sin_family = AF_INET;
     servaddr.sin_addr.s_addr = INADDR_ANY;
     servaddr.sin_port = htons(port_);
 
-    if (::bind(udp_sock_, reinterpret_cast<sockaddr*>(&servaddr),
+    if (::bind(r.udp_sock, reinterpret_cast<sockaddr*>(&servaddr),
              sizeof(servaddr)) < 0) {
         perror("bind UDP");
         return false;
     }
 
+    // Room for bursts between two batches (capped by net.core.rmem_max)
+    int rcvbuf = UDP_RCVBUF;
+    ::setsockopt(r.udp_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    // One receive slot per datagram of a recvmmsg batch
+    size_t batch = static_cast<size_t>(udp_batch_);
+    r.udp_msgs.assign(batch, mmsghdr{});
+    r.udp_iov.resize(batch);
+    r.udp_addrs.resize(batch);
+    r.udp_bufs.resize(batch * UDP_DATAGRAM_MAX);
+    for (size_t i = 0; i < batch; ++i) {
+        r.udp_iov[i].iov_base = r.udp_bufs.data() + i * UDP_DATAGRAM_MAX;
+        r.udp_iov[i].iov_len  = UDP_DATAGRAM_MAX - 1; // room for a NUL
+        r.udp_msgs[i].msg_hdr.msg_name = &r.udp_addrs[i];
+        r.udp_msgs[i].msg_hdr.msg_iov  = &r.udp_iov[i];
+        r.udp_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
     // TCP
-    tcp_sock_ = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (tcp_sock_ < 0) {
+    r.tcp_sock = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (r.tcp_sock < 0) {
         perror("socket TCP");
         return false;
     }
 
-    int opt = 1;
-    ::setsockopt(tcp_sock_, SOL_SOCKET, SO_REUSEADDR,
+    ::setsockopt(r.tcp_sock, SOL_SOCKET, SO_REUSEADDR,
                  &opt, sizeof(opt));
+    if (reuseport &&
+        ::setsockopt(r.tcp_sock, SOL_SOCKET, SO_REUSEPORT,
+                     &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT (TCP)");
+        return false;
+    }
 
     sockaddr_in servaddr_tcp{};
     servaddr_tcp.sin_family = AF_INET;
     servaddr_tcp.sin_addr.s_addr = INADDR_ANY;
     servaddr_tcp.sin_port = htons(port_);
 
-    if (::bind(tcp_sock_, reinterpret_cast<sockaddr*>(&servaddr_tcp),
+    if (::bind(r.tcp_sock, reinterpret_cast<sockaddr*>(&servaddr_tcp),
              sizeof(servaddr_tcp)) < 0) {
         perror("bind TCP");
         return false;
     }
 
-    if (listen(tcp_sock_, 5) < 0) {
+    if (listen(r.tcp_sock, backlog_) < 0) {
         perror("listen TCP");
         return false;
     }
 
+    // Reactor: both sockets are edge-triggered and drained on each wake-up
+    r.epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (r.epoll_fd < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+
+    // Workers report finished requests through an eventfd
+    r.wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r.wake_fd < 0) {
+        perror("eventfd");
+        return false;
+    }
+
+    for (int fd : {r.udp_sock, r.tcp_sock, r.wake_fd}) {
+        epoll_event ev{};
+        ev.events  = EPOLLIN | EPOLLET;
+        ev.data.fd = fd;
+        if (::epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Initialize and bind the sockets of every reactor
+bool EventServer::init_sockets() {
+    for (auto& r : reactors_) {
+        if (!init_reactor(*r)) return false;
+    }
+
+    // Event expiry and the stats signal are handled on reactor 0
+    for (int fd : {timer_fd_, signal_fd_}) {
+        if (fd < 0) continue;
+        epoll_event ev{};
+        ev.events  = EPOLLIN;
+        ev.data.fd = fd;
+        if (::epoll_ctl(reactors_[0]->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            return false;
+        }
+    }
+
     if (verbose_) {
         cout << "[ES] UDP & TCP sockets bound on port " << port_ << "\n";
-        cout << "[ES] Event Server running (UDP+TCP) on port " << port_ << "\n";
+        cout << "[ES] Event Server running (UDP+TCP) on port " << port_
+             << " with " << reactors_.size() << " reactor(s)\n";
     }
 
     return true;
 }
 
 void EventServer::run() {
+    // A peer closing mid-reply must not kill the server (sendfile has
+    // no MSG_NOSIGNAL)
+    ::signal(SIGPIPE, SIG_IGN);
+
+    // SIGUSR1 is read by reactor 0; block it before any thread starts
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    ::pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    signal_fd_ = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd_ < 0) perror("signalfd");
+
     if (!init_sockets()) {
         cerr << "Failed to init sockets\n";
         return;
     }
-    main_loop();
+    compactor_ = thread([this] { compactor_loop(); });
+    if (durability_ == Durability::Batched) {
+        flusher_ = thread([this] { flusher_loop(); });
+    }
+    if (watch_data_) {
+        watcher_ = thread([this] { watch_loop(); });
+    }
+    if (threads_ > 0) {
+        pool_ = make_unique<ThreadPool>(static_cast<size_t>(threads_));
+        if (verbose_) {
+            cout << "[ES] " << threads_ << " TCP worker thread(s)\n";
+        }
+    }
+
+    // Reactor 0 runs on the calling thread, the others get their own
+    vector<thread> threads;
+    for (size_t i = 1; i < reactors_.size(); ++i) {
+        Reactor* r = reactors_[i].get();
+        threads.emplace_back([this, r] { main_loop(*r); });
+    }
+    main_loop(*reactors_[0]);
+    for (auto& t : threads) t.join();
 }
 
-// Main server loop: handle UDP and TCP requests using select
-void EventServer::main_loop() {
-    fd_set rfds;
-    int maxfd = max(udp_sock_, tcp_sock_);
+// Reactor loop: epoll multiplexing UDP and every TCP connection it owns
+void EventServer::main_loop(Reactor& r) {
+    epoll_event events[MAX_EPOLL_EVENTS];
 
     while (true) {
-        FD_ZERO(&rfds);
-        FD_SET(udp_sock_, &rfds);
-        FD_SET(tcp_sock_, &rfds);
-
-        int ret = ::select(maxfd + 1, &rfds, nullptr, nullptr, nullptr);
-        if (ret < 0) {
+        int n = ::epoll_wait(r.epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (n < 0) {
             if (errno == EINTR) continue;
-            perror("select");
+            perror("epoll_wait");
             break;
         }
 
-        if (FD_ISSET(udp_sock_, &rfds)) {
-            handle_udp_request();
-        }
-
-        if (FD_ISSET(tcp_sock_, &rfds)) {
-            sockaddr_in cliaddr{};
-            socklen_t len = sizeof(cliaddr);
-            int conn_fd = ::accept(tcp_sock_,
-                                   reinterpret_cast<sockaddr*>(&cliaddr),
-                                   &len);
-            if (conn_fd < 0) {
-                perror("accept");
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == r.udp_sock) {
+                while (handle_udp_batch(r)) {}
+            } else if (fd == r.tcp_sock) {
+                accept_clients(r);
+            } else if (fd == r.wake_fd) {
+                complete_requests(r);
+            } else if (fd == timer_fd_) {
+                expire_events();
+            } else if (fd == signal_fd_) {
+                report_stats();
             } else {
-                if (verbose_) {
-                    cout << "[ES] New TCP connection accepted\n";
-                }
-                handle_tcp_client(conn_fd);
-                ::close(conn_fd);
+                handle_connection_event(r, fd, events[i].events);
             }
         }
     }
 }
 
+// SIGUSR1: print runtime counters to stdout
+void EventServer::report_stats() {
+    signalfd_siginfo si;
+    while (::read(signal_fd_, &si, sizeof(si)) > 0) {}
+
+    FileCache::Stats fc = file_cache_->stats();
+    cout << "[ES] file cache: " << fc.entries << " file(s), "
+         << fc.bytes << " bytes, " << fc.hits << " hit(s), "
+         << fc.misses << " miss(es)" << endl;
+}
+
 // --- UDP ---
 
-void EventServer::send_udp_reply(const string& reply,
-                                 sockaddr_in& cliaddr,
-                                 socklen_t cli_len) {
-    if (verbose_) {
-        cout << "[ES][UDP] Sent: \"" << reply << "\"\n";
+// Queue the reply to a UDP request (sent by handle_udp_batch)
+void EventServer::send_udp_reply(const string& reply, UdpPeer& peer) {
+    if (!peer.binary || !protocol::encode_binary(reply, peer.reply)) {
+        peer.reply += reply;
     }
-    ::sendto(udp_sock_, reply.c_str(), reply.size(), 0,
-             reinterpret_cast<sockaddr*>(&cliaddr), cli_len);
 }
 
-// Process incoming UDP request and dispatch to handler
-void EventServer::handle_udp_request() {
-    char buf[1024];
-    sockaddr_in cliaddr{};
-    socklen_t len = sizeof(cliaddr);
+// Receive up to udp_batch_ datagrams with one recvmmsg, run them in
+// order and send the replies that may go out now with one sendmmsg;
+// false once the socket is drained
+bool EventServer::handle_udp_batch(Reactor& r) {
+    size_t batch = r.udp_msgs.size();
+    for (auto& m : r.udp_msgs) m.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+
+    int n = ::recvmmsg(r.udp_sock, r.udp_msgs.data(),
+                       static_cast<unsigned>(batch), MSG_DONTWAIT, nullptr);
+    if (n < 0) {
+        if (errno == EINTR) return true;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) perror("recvmmsg");
+        return false;
+    }
+
+    uint64_t sync_lsn = 0;
+    r.udp_out.clear();
+    string text; // a binary request in its text form
+    for (int i = 0; i < n; ++i) {
+        char* buf = r.udp_bufs.data() + static_cast<size_t>(i) * UDP_DATAGRAM_MAX;
+        size_t len = r.udp_msgs[i].msg_len;
+        buf[len] = '\0';
+
+        UdpPeer peer;
+        peer.sock = r.udp_sock;
+        peer.addr = r.udp_addrs[i];
+        peer.len  = r.udp_msgs[i].msg_hdr.msg_namelen;
+        if (len > 0 && static_cast<uint8_t>(buf[0]) == protocol::BINARY_MAGIC) {
+            // Malformed frames are dropped, like unknown text commands
+            text.clear();
+            if (!protocol::decode_binary(string_view(buf, len), text)) continue;
+            peer.binary = true;
+            buf = &text[0];
+            len = text.size();
+        }
+        uint32_t rid = udp_request_id(string_view(buf, len));
+        if (rid != 0 && answer_retransmit(r, peer, rid)) {
+            if (!peer.reply.empty()) r.udp_out.push_back(move(peer));
+            continue;
+        }
 
-    ssize_t n = ::recvfrom(udp_sock_, buf, sizeof(buf) - 1, 0,
-                           reinterpret_cast<sockaddr*>(&cliaddr), &len);
-    if (n <= 0) return;
-    buf[n] = '\0';
+        handle_udp_request(buf, peer);
+        uint64_t lsn = take_pending_lsn();
+        if (rid != 0) remember_reply(r, peer, rid, lsn);
+        if (udp_reply_ready(r, peer, lsn, sync_lsn)) r.udp_out.push_back(move(peer));
+    }
+    if (sync_lsn) wal_->sync_to(sync_lsn); // strict: one sync per batch
+    if (!r.udp_out.empty()) send_udp_replies(r.udp_sock, r.udp_out);
+    return static_cast<size_t>(n) == batch;
+}
 
+// Parse one UDP request and run its handler, which queues the reply
+void EventServer::handle_udp_request(const char* buf, UdpPeer& peer) {
     string msg(buf);
     if (verbose_) {
         cout << "[ES][UDP] Received: \"" << msg << "\"\n";
@@ -418,371 +1458,965 @@ void EventServer::handle_udp_request() {
     if (cmd == "LIN") {
         string uid, pass;
         iss >> uid >> pass;
-        handle_LIN(uid, pass, cliaddr, len);
+        handle_LIN(uid, pass, peer);
     } else if (cmd == "LOU") {
         string uid, pass;
         iss >> uid >> pass;
-        handle_LOU(uid, pass, cliaddr, len);
+        handle_LOU(uid, pass, peer);
     } else if (cmd == "UNR") {
         string uid, pass;
         iss >> uid >> pass;
-        handle_UNR(uid, pass, cliaddr, len);
-    } else if (cmd == "LME") {
-        string uid, pass;
-        iss >> uid >> pass;
-        handle_LME(uid, pass, cliaddr, len);
-    } else if (cmd == "LMR") {
-        string uid, pass;
-        iss >> uid >> pass;
-        handle_LMR(uid, pass, cliaddr, len);
+        handle_UNR(uid, pass, peer);
+    } else if (cmd == "LME" || cmd == "LMR") {
+        // Optional "@<cursor>" continues a paginated list
+        string uid, pass, cursor;
+        iss >> uid >> pass >> cursor;
+        cursor = cursor.size() > 1 && cursor[0] == '@' ? cursor.substr(1) : "";
+        if (cmd == "LME") {
+            handle_LME(uid, pass, cursor, peer);
+        } else {
+            handle_LMR(uid, pass, cursor, peer);
+        }
     }
 }
 
 // Handle login: register new user or authenticate existing
 void EventServer::handle_LIN(const string& uid,
                              const string& pass,
-                             sockaddr_in& cliaddr,
-                             socklen_t cli_len) {
-    load_users();
-
+                             UdpPeer& peer) {
     if (!valid_uid(uid) || !valid_password(pass)) {
-        send_udp_reply("RLI ERR\n", cliaddr, cli_len);
+        send_udp_reply("RLI ERR\n", peer);
         return;
     }
 
+    shared_lock<shared_mutex> gate(wal_gate_);
+    unique_lock<shared_mutex> lk(users_mtx_);
     User* u = find_user(uid);
     if (!u) {
         // Register new user
+        if (!log_mutation({WalOp::UserRegistered, {uid, pass}})) {
+            send_udp_reply("RLI ERR\n", peer);
+            return;
+        }
         User nu;
         nu.uid       = uid;
         nu.password  = pass;
         nu.loggedIn  = true;
-        users_.push_back(nu);
-        save_users();
+        users_.insert(uid, nu);
         if (verbose_) {
             cout << "[ES] LIN: new user " << uid
                       << " registered & logged in\n";
         }
-        send_udp_reply("RLI REG\n", cliaddr, cli_len);
+        send_udp_reply("RLI REG\n", peer);
     } else {
         if (u->password != pass) {
-            send_udp_reply("RLI NOK\n", cliaddr, cli_len);
+            send_udp_reply("RLI NOK\n", peer);
         } else {
             u->loggedIn = true;
-            send_udp_reply("RLI OK\n", cliaddr, cli_len);
+            send_udp_reply("RLI OK\n", peer);
         }
     }
 }
 
-// Handle logout request
-void EventServer::handle_LOU(const string& uid,
+// Handle logout request
+void EventServer::handle_LOU(const string& uid,
+                             const string& pass,
+                             UdpPeer& peer) {
+    unique_lock<shared_mutex> lk(users_mtx_);
+    User* u = find_user(uid);
+    if (!u || u->password != pass) {
+        send_udp_reply("RLO ERR\n", peer);
+        return;
+    }
+    if (!u->loggedIn) {
+        send_udp_reply("RLO NOK\n", peer);
+        return;
+    }
+    u->loggedIn = false;
+    send_udp_reply("RLO OK\n", peer);
+}
+
+// Handle user unregister request
+void EventServer::handle_UNR(const string& uid,
+                             const string& pass,
+                             UdpPeer& peer) {
+    shared_lock<shared_mutex> gate(wal_gate_);
+    unique_lock<shared_mutex> lk(users_mtx_);
+    User* u = find_user(uid);
+    if (!u) {
+        send_udp_reply("RUR UNR\n", peer);
+        return;
+    }
+    if (u->password != pass) {
+        send_udp_reply("RUR WRP\n", peer);
+        return;
+    }
+    if (!u->loggedIn) {
+        send_udp_reply("RUR NOK\n", peer);
+        return;
+    }
+    // Remove user from list
+    if (!log_mutation({WalOp::UserRemoved, {uid}})) {
+        send_udp_reply("RUR ERR\n", peer);
+        return;
+    }
+    users_.erase(uid);
+    send_udp_reply("RUR OK\n", peer);
+}
+
+// Events owned by uid after cursor (an EID), as "RME" list items.
+// Returns the reply status: OK (items filled), NLG, NOK or ERR.
+string EventServer::my_events(const string& uid, const string& pass,
+                              const string& cursor, vector<ListItem>& items) {
+    shared_lock<shared_mutex> ul(users_mtx_);
+    User* u = find_user(uid);
+    if (!u || u->password != pass || !u->loggedIn) return "NLG";
+    ul.unlock();
+    if (!cursor.empty() && DenseTable<Event, 3>::index_of(cursor) < 0) return "ERR";
+
+    shared_lock<shared_mutex> el(events_mtx_);
+    auto mine = events_by_owner_.find(uid);
+    if (mine == events_by_owner_.end() || mine->second.empty()) return "NOK";
+
+    const vector<string>& eids = mine->second;
+    for (auto it = upper_bound(eids.begin(), eids.end(), cursor); it != eids.end(); ++it) {
+        const Event* ev = events_.find(*it);
+        if (!ev) continue;
+        int st;
+        {
+            lock_guard<mutex> lk(event_lock(*it));
+            st = compute_event_state(*ev);
+        }
+        items.push_back({" " + *it + " " + to_string(st), *it});
+    }
+    return "OK";
+}
+
+// Reservations of uid after cursor ("EID.n": past the first n of that
+// EID, which stays valid as reservations are added), as "RMR" list items
+string EventServer::my_reservations(const string& uid, const string& pass,
+                                    const string& cursor,
+                                    vector<ListItem>& items) {
+    shared_lock<shared_mutex> ul(users_mtx_);
+    User* u = find_user(uid);
+    if (!u || u->password != pass || !u->loggedIn) return "NLG";
+    ul.unlock();
+
+    string after_eid;
+    long   skip = 0;
+    if (!cursor.empty()) {
+        size_t dot = cursor.find('.');
+        const char* last = cursor.data() + cursor.size();
+        if (dot == string::npos ||
+            DenseTable<Event, 3>::index_of(string_view(cursor).substr(0, dot)) < 0 ||
+            from_chars(cursor.data() + dot + 1, last, skip).ptr != last || skip < 0)
+            return "ERR";
+        after_eid = cursor.substr(0, dot);
+    }
+
+    lock_guard<mutex> rl(reservations_mtx_);
+    auto mine = reservations_by_user_.find(uid);
+    if (mine == reservations_by_user_.end() || mine->second.empty()) return "NOK";
+
+    string eid;      // EID of the previous item
+    long   nth = 0;  // its position among that EID's reservations
+    for (size_t idx : mine->second) {
+        const Reservation& r = reservations_[idx];
+        nth = r.eid == eid ? nth + 1 : 1;
+        eid = r.eid;
+        if (!after_eid.empty() &&
+            (r.eid < after_eid || (r.eid == after_eid && nth <= skip)))
+            continue;
+
+        string date = "00-00-0000";
+        string time = "00:00:00";
+        if (r.timestamp.size() >= 19) {
+            date = r.timestamp.substr(0, 10);
+            time = r.timestamp.substr(11, 8);
+        }
+        items.push_back({" " + r.eid + " " + date + " " + time + " " + to_string(r.seats),
+                         r.eid + "." + to_string(nth)});
+    }
+    return "OK";
+}
+
+// Reply with a list in one datagram if it fits. Otherwise send the page
+// that fits, ending in "@<cursor>" to request the rest with; a fresh
+// request for a list too long to page through is answered "TCP".
+void EventServer::send_udp_list(const char* type, const vector<ListItem>& items,
+                                bool resumed, UdpPeer& peer) {
+    string reply = string(type) + " OK";
+    size_t total = reply.size() + 1;
+    for (const auto& item : items) total += item.text.size();
+    if (total <= UDP_LIST_PAGE) {
+        for (const auto& item : items) reply += item.text;
+        send_udp_reply(reply + "\n", peer);
+        return;
+    }
+    if (!resumed && total > UDP_LIST_TCP) {
+        send_udp_reply(string(type) + " TCP\n", peer);
+        return;
+    }
+
+    size_t i = 0;
+    for (; i < items.size(); ++i) {
+        size_t cursor_len = 2 + items[i].cursor.size() + 1; // " @...\n"
+        if (i > 0 && reply.size() + items[i].text.size() + cursor_len > UDP_LIST_PAGE)
+            break;
+        reply += items[i].text;
+    }
+    if (i < items.size()) reply += " @" + items[i - 1].cursor;
+    send_udp_reply(reply + "\n", peer);
+}
+
+// LME: myevents — RME OK [EID state] (paginated, see send_udp_list)
+void EventServer::handle_LME(const string& uid,
                              const string& pass,
-                             sockaddr_in& cliaddr,
-                             socklen_t cli_len) {
-    User* u = find_user(uid);
-    if (!u || u->password != pass) {
-        send_udp_reply("RLO ERR\n", cliaddr, cli_len);
+                             const string& cursor,
+                             UdpPeer& peer) {
+    vector<ListItem> items;
+    string status = my_events(uid, pass, cursor, items);
+    if (status != "OK") {
+        send_udp_reply("RME " + status + "\n", peer);
         return;
     }
-    if (!u->loggedIn) {
-        send_udp_reply("RLO NOK\n", cliaddr, cli_len);
+    send_udp_list("RME", items, !cursor.empty(), peer);
+}
+
+// LMR: myreservations — RMR OK [EID date time seats] (paginated)
+void EventServer::handle_LMR(const string& uid,
+                             const string& pass,
+                             const string& cursor,
+                             UdpPeer& peer) {
+    vector<ListItem> items;
+    string status = my_reservations(uid, pass, cursor, items);
+    if (status != "OK") {
+        send_udp_reply("RMR " + status + "\n", peer);
         return;
     }
-    u->loggedIn = false;
-    send_udp_reply("RLO OK\n", cliaddr, cli_len);
+    send_udp_list("RMR", items, !cursor.empty(), peer);
 }
 
-// Handle user unregister request
-void EventServer::handle_UNR(const string& uid,
-                             const string& pass,
-                             sockaddr_in& cliaddr,
-                             socklen_t cli_len) {
-    User* u = find_user(uid);
-    if (!u) {
-        send_udp_reply("RUR UNR\n", cliaddr, cli_len);
+// --- TCP reactor ---
+
+// Accept every pending connection and register it with the reactor
+void EventServer::accept_clients(Reactor& r) {
+    while (true) {
+        sockaddr_in cliaddr{};
+        socklen_t len = sizeof(cliaddr);
+        int conn_fd = ::accept4(r.tcp_sock,
+                                reinterpret_cast<sockaddr*>(&cliaddr),
+                                &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (conn_fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+
+        epoll_event ev{};
+        ev.events  = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = conn_fd;
+        if (::epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, conn_fd, &ev) < 0) {
+            perror("epoll_ctl");
+            ::close(conn_fd);
+            continue;
+        }
+
+        auto c = make_unique<Connection>();
+        c->fd = conn_fd;
+        r.conns.emplace(conn_fd, move(c));
+
+        if (verbose_) {
+            cout << "[ES] New TCP connection accepted\n";
+        }
+    }
+}
+
+// Resume a connection's state machine after epoll reported activity
+void EventServer::handle_connection_event(Reactor& r, int fd,
+                                          uint32_t events) {
+    auto it = r.conns.find(fd);
+    if (it == r.conns.end()) return;
+    Connection& c = *it->second;
+
+    // A worker owns the request: just buffer input, close once it is done
+    if (c.state == Connection::State::Processing) {
+        if (!fill_input(c)) c.eof = true;
         return;
     }
-    if (u->password != pass) {
-        send_udp_reply("RUR WRP\n", cliaddr, cli_len);
+
+    if (events & EPOLLERR) {
+        close_connection(r, fd);
         return;
     }
-    if (!u->loggedIn) {
-        send_udp_reply("RUR NOK\n", cliaddr, cli_len);
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !fill_input(c)) {
+        close_connection(r, fd);
         return;
     }
-    // Remove user from list
-    users_.erase(remove_if(users_.begin(), users_.end(),
-                                [&](const User& usr){ return usr.uid == uid; }),
-                 users_.end());
-    save_users();
-    send_udp_reply("RUR OK\n", cliaddr, cli_len);
+    if (!advance_connection(r, c)) {
+        close_connection(r, fd);
+    }
 }
 
-// LME: myevents
-void EventServer::handle_LME(const string& uid,
-                             const string& pass,
-                             sockaddr_in& cliaddr,
-                             socklen_t cli_len) {
-    load_events();
+// Drain the socket: header bytes into c.in, CRE file data to its temp
+// file. Anything after the request is kept in c.pipelined on a
+// keep-alive connection and dropped otherwise (c.in must not change
+// once a handler may be reading its arguments). While a header is read
+// at most MAX_HEADER_LEN unparsed bytes are buffered, so a CRE body is
+// left to receive_body; c.in_full tells advance_connection to read on.
+// A keep-alive connection stops reading once PIPELINE_MAX bytes wait;
+// next_request reads on.
+bool EventServer::fill_input(Connection& c) {
+    char buf[16384];
+    c.in_full = false;
+    while (!c.eof) {
+        bool   header = c.state == Connection::State::ReadCommand ||
+                        c.state == Connection::State::ReadArgs;
+        size_t room   = sizeof(buf);
+        if (header) {
+            size_t buffered = c.in.size() - c.in_pos;
+            if (buffered >= MAX_HEADER_LEN) {
+                c.in_full = true;
+                break;
+            }
+            room = min(room, MAX_HEADER_LEN - buffered);
+        } else if (c.keep_alive && c.pipelined.size() >= PIPELINE_MAX) {
+            break;
+        }
 
-    User* u = find_user(uid);
-    if (!u || u->password != pass || !u->loggedIn) {
-        send_udp_reply("RME NLG\n", cliaddr, cli_len);
-        return;
+        ssize_t r;
+        if (c.state == Connection::State::ReadBody &&
+            c.body_got < c.body_need) {
+            r = receive_body(c);
+        } else {
+            r = ::read(c.fd, buf, room);
+            if (r > 0 && header) {
+                c.in.append(buf, static_cast<size_t>(r));
+            } else if (r > 0 && c.keep_alive) {
+                c.pipelined.append(buf, static_cast<size_t>(r));
+            }
+        }
+        if (r > 0) {
+            continue;
+        } else if (r == 0) {
+            c.eof = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            return false;
+        }
     }
+    return true;
+}
+
+// Open the temp file for a CRE body and store the bytes that arrived
+// with the header
+void EventServer::start_body(Connection& c) {
+    c.body_need = static_cast<size_t>(c.num[7]);
 
-    vector<const Event*> mine;
-    for (const auto& ev : events_) {
-        if (ev.owner_uid == uid) mine.push_back(&ev);
+    string path = string("data/") + UPLOAD_PREFIX + "XXXXXX";
+    c.body_fd = ::mkostemp(&path[0], O_CLOEXEC);
+    if (c.body_fd < 0 || ::pipe2(c.body_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        perror("CRE upload");
+        c.body_failed = true;
     }
+    if (c.body_fd >= 0) c.body_path = path;
 
-    if (mine.empty()) {
-        send_udp_reply("RME NOK\n", cliaddr, cli_len);
-        return;
+    size_t take = min(c.body_need, c.in.size() - c.in_pos);
+    if (!c.body_failed && take > 0 &&
+        ::write(c.body_fd, c.in.data() + c.in_pos, take) !=
+            static_cast<ssize_t>(take)) {
+        c.body_failed = true;
+    }
+    c.body_got += take;
+    c.in_pos   += take;
+}
+
+// Move body bytes from the socket to the temp file through the pipe,
+// never through user space. Returns the read()-style result; once
+// storing has failed the rest of the body is read and discarded.
+ssize_t EventServer::receive_body(Connection& c) {
+    size_t want = min(c.body_need - c.body_got, BODY_CHUNK);
+    if (c.body_failed) {
+        char buf[16384];
+        ssize_t r = ::read(c.fd, buf, min(want, sizeof(buf)));
+        if (r > 0) c.body_got += static_cast<size_t>(r);
+        return r;
+    }
+
+    ssize_t r = ::splice(c.fd, nullptr, c.body_pipe[1], nullptr, want,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (r <= 0) return r;
+    c.body_got += static_cast<size_t>(r);
+
+    // The file never blocks: drain the pipe completely
+    for (ssize_t left = r; left > 0; ) {
+        ssize_t w = ::splice(c.body_pipe[0], nullptr, c.body_fd, nullptr,
+                             static_cast<size_t>(left), SPLICE_F_MOVE);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            perror("CRE upload");
+            c.body_failed = true;
+            // Empty the pipe so later data is not stuck behind it
+            char buf[16384];
+            while (::read(c.body_pipe[0], buf, sizeof(buf)) > 0) {}
+            break;
+        }
+        left -= w;
     }
+    return r;
+}
+
+// Header layout of each TCP command
+struct TcpCommandSpec {
+    const char* name;
+    TcpCommand  cmd;
+    size_t      nargs;
+    TcpField    fields[8];
+};
+
+static const TcpCommandSpec TCP_COMMANDS[] = {
+    {"CPS", TcpCommand::CPS, 3, {TcpField::Uid, TcpField::Pass, TcpField::Pass}},
+    {"CRE", TcpCommand::CRE, 8, {TcpField::Uid, TcpField::Pass, TcpField::Name,
+                                 TcpField::Date, TcpField::Time, TcpField::Count,
+                                 TcpField::Fname, TcpField::Count}},
+    {"LST", TcpCommand::LST, 0, {}},
+    {"CLS", TcpCommand::CLS, 3, {TcpField::Uid, TcpField::Pass, TcpField::Eid}},
+    {"RID", TcpCommand::RID, 4, {TcpField::Uid, TcpField::Pass, TcpField::Eid,
+                                 TcpField::Count}},
+    {"SED", TcpCommand::SED, 1, {TcpField::Eid}},
+    {"LME", TcpCommand::LME, 2, {TcpField::Uid, TcpField::Pass}},
+    {"LMR", TcpCommand::LMR, 2, {TcpField::Uid, TcpField::Pass}},
+    {"KAL", TcpCommand::KAL, 0, {}},
+};
+
+static const TcpCommandSpec* find_tcp_command(string_view name) {
+    for (const auto& spec : TCP_COMMANDS) {
+        if (name == spec.name) return &spec;
+    }
+    return nullptr;
+}
+
+static const TcpCommandSpec& tcp_command_spec(TcpCommand cmd) {
+    return TCP_COMMANDS[static_cast<size_t>(cmd) - 1];
+}
+
+// Run the state machine as far as buffered input allows.
+// Returns false when the connection should be closed.
+bool EventServer::advance_connection(Reactor& r, Connection& c) {
+    while (true) {
+        switch (c.state) {
+        case Connection::State::ReadCommand: {
+            bool ready;
+            if (!unframe_request(c, ready)) {
+                send_tcp_line(c, "ERR\n");
+                c.keep_alive = false;
+                c.state = Connection::State::Write;
+                break;
+            }
+            // Reading stopped at MAX_HEADER_LEN with no new edge to come:
+            // the lexer has consumed some of it, so read on
+            if (!ready) {
+                if (!c.in_full) return !c.eof;
+                if (!fill_input(c)) return false;
+                break;
+            }
+
+            string_view tok;
+            if (!next_token(c, tok)) {
+                if (c.eof || c.in.size() - c.in_pos > MAX_TOKEN_LEN)
+                    return false;
+                if (!c.in_full) return true;
+                if (!fill_input(c)) return false;
+                break;
+            }
+            if (verbose_) {
+                cout << "[ES][TCP] Command: " << tok << "\n";
+            }
+            const TcpCommandSpec* spec = find_tcp_command(tok);
+            if (!spec) {
+                // The request's end is unknown: close after the reply
+                send_tcp_line(c, "ERR\n");
+                c.keep_alive = false;
+                c.state = Connection::State::Write;
+                break;
+            }
+            c.cmd   = spec->cmd;
+            c.nargs = spec->nargs;
+            c.state = Connection::State::ReadArgs;
+            break;
+        }
+
+        case Connection::State::ReadArgs: {
+            // Each field is checked as it is lexed
+            const TcpCommandSpec& spec = tcp_command_spec(c.cmd);
+            string_view tok;
+            while (c.argc < c.nargs && next_token(c, tok)) {
+                size_t i = c.argc++;
+                c.arg_span[i] = {static_cast<uint32_t>(tok.data() - c.in.data()),
+                                 static_cast<uint32_t>(tok.size())};
+                if (check_field(spec.fields[i], tok, c.num[i]))
+                    c.arg_ok |= 1u << i;
+            }
+            if (c.argc < c.nargs && !c.eof) {
+                if (c.in.size() - c.in_pos > MAX_TOKEN_LEN) return false;
+                if (!c.in_full) return true;
+                if (!fill_input(c)) return false;
+                break;
+            }
+            // Only a well-formed CRE header is followed by file data;
+            // bytes already read past the header start the body. After
+            // a malformed one the next request cannot be found.
+            if (c.cmd == TcpCommand::CRE) {
+                if (cre_header_valid(c)) {
+                    start_body(c);
+                    c.state = Connection::State::ReadBody;
+                    // The rest of the body may wait unread behind the
+                    // header limit, with no new edge to come
+                    if (c.in_full && !fill_input(c)) return false;
+                    break;
+                }
+                c.keep_alive = false;
+            }
+            // KAL only changes the connection: answered by the reactor
+            if (c.cmd == TcpCommand::KAL) {
+                handle_KAL(c);
+                c.state = Connection::State::Write;
+                break;
+            }
+            dispatch_request(r, c);
+            if (c.state == Connection::State::Processing) return true;
+            break;
+        }
+
+        case Connection::State::ReadBody: {
+            if (c.body_got < c.body_need && !c.eof) {
+                return true;
+            }
+            dispatch_request(r, c);
+            if (c.state == Connection::State::Processing) return true;
+            break;
+        }
 
-    sort(mine.begin(), mine.end(),
-              [](const Event* a, const Event* b) {
-                  return a->eid < b->eid;
-              });
+        case Connection::State::Processing:
+            return true;
 
-    string reply = "RME OK";
-    for (const Event* ev : mine) {
-        int st = compute_event_state(*ev);
-        reply += " " + ev->eid + " " + to_string(st);
+        case Connection::State::Write:
+            if (!flush_output(c)) return false;
+            if (!c.out_done()) return true;
+            // Without keep-alive, close once the reply is out
+            if (!c.keep_alive || !next_request(c)) return false;
+            break;
+        }
     }
-    reply += "\n";
-    send_udp_reply(reply, cliaddr, cli_len);
 }
 
-// LMR: myreservations — RMR OK [EID date time seats]
-void EventServer::handle_LMR(const string& uid,
-                             const string& pass,
-                             sockaddr_in& cliaddr,
-                             socklen_t cli_len) {
-    load_reservations();
+// If the next request is a binary frame, replace it in c.in by its text
+// form, so both forms share the lexer, field checks and handlers; its
+// reply is framed as well. ready is false while the frame is incomplete;
+// false for a malformed frame.
+bool EventServer::unframe_request(Connection& c, bool& ready) {
+    ready = true;
+    size_t start = c.in_pos;
+    while (start < c.in.size() && isspace(static_cast<unsigned char>(c.in[start]))) {
+        ++start;
+    }
+    c.in_pos = start; // the lexer would skip it too; frees header room
+    if (start == c.in.size() ||
+        static_cast<uint8_t>(c.in[start]) != protocol::BINARY_MAGIC)
+        return true;
+
+    c.binary = true;
+    size_t avail = c.in.size() - start;
+    size_t size  = protocol::frame_size(c.in.data() + start, avail);
+    if (size > MAX_REQUEST_FRAME) return false;
+    if (size == 0 || avail < size) {
+        ready = false;
+        return true;
+    }
+
+    string text;
+    if (!protocol::decode_binary(string_view(c.in).substr(start, size), text))
+        return false;
+    c.in.replace(start, size, text);
+    c.in_pos   = start;
+    c.scan_pos = start;
+    return true;
+}
 
-    User* u = find_user(uid);
-    if (!u || u->password != pass || !u->loggedIn) {
-        send_udp_reply("RMR NLG\n", cliaddr, cli_len);
-        return;
+// Reset a keep-alive connection for its next request: the unparsed
+// rest of the header buffer and the input that waited while the last
+// request was handled become the new header buffer. Returns false if
+// the socket failed.
+bool EventServer::next_request(Connection& c) {
+    c.release_request();
+    c.out_seg     = 0;
+    c.out_pos     = 0;
+    c.body_need   = 0;
+    c.body_got    = 0;
+    c.body_failed = false;
+
+    c.in.erase(0, c.in_pos);
+    c.in += c.pipelined;
+    c.pipelined.clear();
+    c.in_pos   = 0;
+    c.scan_pos = 0;
+
+    c.binary   = false;
+    c.cmd      = TcpCommand::Unknown;
+    c.nargs    = 0;
+    c.argc     = 0;
+    c.arg_span = {};
+    c.arg_ok   = 0;
+    c.num      = {};
+    c.state    = Connection::State::ReadCommand;
+
+    // Input may have been left unread (PIPELINE_MAX), with no new edge
+    return fill_input(c);
+}
+
+// Send as much of the pending reply as the socket accepts. Runs of
+// memory segments go out in one sendmsg; file segments use sendfile.
+bool EventServer::flush_output(Connection& c) {
+    while (!c.out_done()) {
+        OutSegment& seg = c.out[c.out_seg];
+
+        if (seg.fd >= 0) {
+            ssize_t n = ::sendfile(c.fd, seg.fd, &seg.off, seg.len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            if (n == 0) return false; // file shrank under us
+            seg.len -= static_cast<size_t>(n);
+            if (seg.len == 0) {
+                ::close(seg.fd);
+                seg.fd = -1;
+                ++c.out_seg;
+            }
+            continue;
+        }
+
+        iovec  iov[16];
+        size_t cnt = 0;
+        for (size_t i = c.out_seg;
+             i < c.out.size() && cnt < 16 && c.out[i].fd < 0; ++i) {
+            string_view d = c.out[i].data();
+            size_t skip = (i == c.out_seg) ? c.out_pos : 0;
+            iov[cnt].iov_base = const_cast<char*>(d.data() + skip);
+            iov[cnt].iov_len  = d.size() - skip;
+            ++cnt;
+        }
+        msghdr msg{};
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = cnt;
+        ssize_t n = ::sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        // Advance past what was sent (and any empty segments)
+        c.out_pos += static_cast<size_t>(n);
+        while (!c.out_done() && c.out[c.out_seg].fd < 0 &&
+               c.out_pos >= c.out[c.out_seg].data().size()) {
+            c.out_pos -= c.out[c.out_seg].data().size();
+            ++c.out_seg;
+        }
     }
 
-    vector<const Reservation*> mine;
-    for (const auto& r : reservations_) {
-        if (r.uid == uid) mine.push_back(&r);
+    // Whole reply queued: let the corked tail go out
+    if (c.corked) {
+        int off = 0;
+        ::setsockopt(c.fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+        c.corked = false;
     }
+    return true;
+}
 
-    if (mine.empty()) {
-        send_udp_reply("RMR NOK\n", cliaddr, cli_len);
+// Run a complete request on a worker (or inline without a pool)
+void EventServer::dispatch_request(Reactor& r, Connection& c) {
+    if (!pool_) {
+        handle_tcp_request(c);
+        c.state = await_durable(r, c.fd) ? Connection::State::Write
+                                         : Connection::State::Processing;
         return;
     }
 
-    sort(mine.begin(), mine.end(),
-              [](const Reservation* a, const Reservation* b) {
-                  if (a->eid != b->eid) return a->eid < b->eid;
-                  return a->timestamp < b->timestamp;
-              });
+    c.state = Connection::State::Processing;
+    Connection* cp = &c;
+    Reactor*    rp = &r;
+    pool_->submit([this, rp, cp] {
+        handle_tcp_request(*cp);
+        if (!await_durable(*rp, cp->fd)) return; // the flusher completes it
+        {
+            lock_guard<mutex> lk(rp->done_mtx);
+            rp->done_fds.push_back(cp->fd);
+        }
+        uint64_t one = 1;
+        ssize_t w = ::write(rp->wake_fd, &one, sizeof(one));
+        (void)w;
+    });
+}
 
-    string reply = "RMR OK";
-    for (const Reservation* r : mine) {
-        string date = "00-00-0000";
-        string time = "00:00:00";
-        if (r->timestamp.size() >= 19) {
-            date = r->timestamp.substr(0, 10);
-            time = r->timestamp.substr(11, 8);
+// Pick up requests finished by workers and start sending their replies
+void EventServer::complete_requests(Reactor& r) {
+    uint64_t cnt;
+    while (::read(r.wake_fd, &cnt, sizeof(cnt)) > 0) {}
+
+    vector<int> done;
+    {
+        lock_guard<mutex> lk(r.done_mtx);
+        done.swap(r.done_fds);
+    }
+    for (int fd : done) {
+        auto it = r.conns.find(fd);
+        if (it == r.conns.end()) continue;
+        Connection& c = *it->second;
+        c.state = Connection::State::Write;
+        if (!advance_connection(r, c)) {
+            close_connection(r, fd);
         }
-        reply += " " + r->eid + " " + date + " " + time + " " + to_string(r->seats);
     }
-    reply += "\n";
+}
 
-    send_udp_reply(reply, cliaddr, cli_len);
+void EventServer::close_connection(Reactor& r, int fd) {
+    ::epoll_ctl(r.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    r.conns.erase(fd);
 }
 
 // --- TCP utils ---
 
-void EventServer::send_tcp_line(int fd, const string& line) {
-    ::write(fd, line.c_str(), line.size());
+// Queue a reply line, as a frame if the request was one and the line has
+// a binary form; true if it went out framed
+bool EventServer::send_tcp_line(Connection& c, const string& line) {
+    if (c.out.empty() || !c.out.back().owned()) {
+        c.out.emplace_back();
+    }
+    string& out = c.out.back().bytes;
+    if (c.binary && protocol::encode_binary(line, out)) return true;
+    out += line;
+    return false;
 }
 
-bool EventServer::read_token(int fd, string& tok) {
-    tok.clear();
-    char c;
-    while (true) {
-        ssize_t r = ::read(fd, &c, 1);
-        if (r <= 0) return false;
-        if (!isspace(static_cast<unsigned char>(c))) {
-            tok.push_back(c);
-            break;
-        }
-    }
-    while (true) {
-        ssize_t r = ::read(fd, &c, 1);
-        if (r <= 0) break;
-        if (isspace(static_cast<unsigned char>(c))) break;
-        tok.push_back(c);
+// Queue a buffer shared with other replies (no copy)
+void EventServer::send_tcp_shared(Connection& c,
+                                  shared_ptr<const string> buf) {
+    c.out.emplace_back();
+    c.out.back().shared = move(buf);
+}
+
+// Queue a cached file mapping (sent from memory with the header)
+void EventServer::send_tcp_mapped(Connection& c,
+                                  shared_ptr<const MappedFile> map) {
+    c.out.emplace_back();
+    c.out.back().map = move(map);
+}
+
+// Queue len bytes of an open file; the connection takes ownership of fd.
+// The socket is corked so the header, file and tail leave in full
+// segments rather than a short packet on each side of the file.
+void EventServer::send_tcp_file(Connection& c, int fd, off_t off, size_t len) {
+    if (!c.corked) {
+        int on = 1;
+        ::setsockopt(c.fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+        c.corked = true;
+    }
+    c.out.emplace_back();
+    c.out.back().fd  = fd;
+    c.out.back().off = off;
+    c.out.back().len = len;
+}
+
+// View the next whitespace-terminated token of the receive buffer, in
+// place. A partial token is not rescanned: the scan resumes at
+// c.scan_pos once more bytes arrive. At end of stream a trailing
+// unterminated token is accepted as well.
+bool EventServer::next_token(Connection& c, string_view& tok) {
+    const char* p = c.in.data();
+    size_t      n = c.in.size();
+
+    size_t start = c.in_pos;
+    while (start < n && isspace(static_cast<unsigned char>(p[start]))) {
+        ++start;
+    }
+    size_t end = max(start, c.scan_pos);
+    while (end < n && !isspace(static_cast<unsigned char>(p[end]))) {
+        ++end;
+    }
+    if (end == n && (!c.eof || end == start)) {
+        c.in_pos   = start;
+        c.scan_pos = end;
+        return false;
     }
+    tok = string_view(p + start, end - start);
+    c.in_pos   = min(end + 1, n); // consume the delimiter
+    c.scan_pos = c.in_pos;
     return true;
 }
 
-// Process TCP client request and dispatch to handler
-void EventServer::handle_tcp_client(int fd) {
-    string cmd;
-    if (!read_token(fd, cmd)) {
-        return;
-    }
+// Check one header field against its kind; Count fields are also parsed
+// into num (-1 if not a plain decimal number)
+bool EventServer::check_field(TcpField kind, string_view tok, long& num) const {
+    num = -1;
+    switch (kind) {
+    case TcpField::Any:  return true;
+    case TcpField::Uid:  return valid_uid(tok);
+    case TcpField::Pass: return valid_password(tok);
+    case TcpField::Name: return valid_event_name(tok);
+    case TcpField::Date: return valid_event_date(tok);
+    case TcpField::Time: return valid_event_time(tok);
+    case TcpField::Fname: return valid_file_name(tok);
+    case TcpField::Eid:
+        return DenseTable<Event, 3>::index_of(tok) >= 0;
+    case TcpField::Count: {
+        long v = 0;
+        auto [end, ec] = from_chars(tok.data(), tok.data() + tok.size(), v);
+        if (tok.empty() || ec != errc() || end != tok.data() + tok.size())
+            return false;
+        num = v;
+        return true;
+    }
+    }
+    return false;
+}
 
-    if (verbose_) {
-        cout << "[ES][TCP] Command: " << cmd << "\n";
-    }
-
-    if (cmd == "CPS") {
-        handle_CPS(fd);
-    } else if (cmd == "CRE") {
-        handle_CRE(fd);
-    } else if (cmd == "LST") {
-        handle_LST(fd);
-    } else if (cmd == "CLS") {
-        handle_CLS(fd);
-    } else if (cmd == "RID") {
-        handle_RID(fd);
-    } else if (cmd == "SED") {
-        handle_SED(fd);
-    } else {
-        send_tcp_line(fd, "ERR\n");
+// Check the CRE header fields that decide whether file data follows
+bool EventServer::cre_header_valid(const Connection& c) const {
+    if (c.argc < 8) return false;
+    long attendance = c.num[5];
+    long fsize      = c.num[7];
+    return c.arg_valid(2) && c.arg_valid(3) && c.arg_valid(4) && c.arg_valid(6) &&
+           attendance >= 10 && attendance <= 999 &&
+           fsize > 0 && fsize <= max_file_size_;
+}
+
+// Dispatch a fully received TCP request to its handler
+void EventServer::handle_tcp_request(Connection& c) {
+    switch (c.cmd) {
+    case TcpCommand::CPS: handle_CPS(c); break;
+    case TcpCommand::CRE: handle_CRE(c); break;
+    case TcpCommand::LST: handle_LST(c); break;
+    case TcpCommand::CLS: handle_CLS(c); break;
+    case TcpCommand::RID: handle_RID(c); break;
+    case TcpCommand::SED: handle_SED(c); break;
+    case TcpCommand::LME: handle_LME(c); break;
+    case TcpCommand::LMR: handle_LMR(c); break;
+    default:              send_tcp_line(c, "ERR\n"); break;
     }
 }
 
 // Handle change password request
-void EventServer::handle_CPS(int fd) {
-    string uid, oldp, newp;
-    if (!read_token(fd, uid) ||
-        !read_token(fd, oldp) ||
-        !read_token(fd, newp)) {
-        send_tcp_line(fd, "RCP ERR\n");
+void EventServer::handle_CPS(Connection& c) {
+    if (c.argc < 3) {
+        send_tcp_line(c, "RCP ERR\n");
         return;
     }
+    string_view uid  = c.arg(0);
+    string_view oldp = c.arg(1);
+    string_view newp = c.arg(2);
 
+    shared_lock<shared_mutex> gate(wal_gate_);
+    unique_lock<shared_mutex> lk(users_mtx_);
     User* u = find_user(uid);
     if (!u) {
-        send_tcp_line(fd, "RCP NID\n");
+        send_tcp_line(c, "RCP NID\n");
         return;
     }
     if (!u->loggedIn) {
-        send_tcp_line(fd, "RCP NLG\n");
+        send_tcp_line(c, "RCP NLG\n");
         return;
     }
     if (u->password != oldp) {
-        send_tcp_line(fd, "RCP NOK\n");
+        send_tcp_line(c, "RCP NOK\n");
         return;
     }
-    if (!valid_password(newp)) {
-        send_tcp_line(fd, "RCP ERR\n");
+    if (!c.arg_valid(2)) {
+        send_tcp_line(c, "RCP ERR\n");
         return;
     }
     // Update password
-    u->password = newp;
-    save_users();
-    send_tcp_line(fd, "RCP OK\n");
-}
-
-// Handle create event request with file upload
-void EventServer::handle_CRE(int fd) {
-    load_events();
-    string uid, pass, name, date, time;
-    string attendance_str, fname, fsize_str;
-
-    // Read request parameters
-    if (!read_token(fd, uid) ||
-        !read_token(fd, pass) ||
-        !read_token(fd, name) ||
-        !read_token(fd, date) ||
-        !read_token(fd, time) ||
-        !read_token(fd, attendance_str) ||
-        !read_token(fd, fname) ||
-        !read_token(fd, fsize_str)) {
-        send_tcp_line(fd, "RCE ERR\n");
+    if (!log_mutation({WalOp::PasswordChanged, {string(uid), string(newp)}})) {
+        send_tcp_line(c, "RCP ERR\n");
         return;
     }
+    u->password = newp;
+    send_tcp_line(c, "RCP OK\n");
+}
 
-    User* u = find_user(uid);
-    if (!u) {
-        send_tcp_line(fd, "RCE NLG\n");
-        return;
-    }
-    if (u->password != pass) {
-        send_tcp_line(fd, "RCE WRP\n");
+// Handle create event request; file data was buffered by the reactor
+void EventServer::handle_CRE(Connection& c) {
+    // Request parameters
+    if (c.argc < 8) {
+        send_tcp_line(c, "RCE ERR\n");
         return;
     }
-    if (!u->loggedIn) {
-        send_tcp_line(fd, "RCE NLG\n");
-        return;
+    string_view uid            = c.arg(0);
+    string_view pass           = c.arg(1);
+    string_view name           = c.arg(2);
+    string_view date           = c.arg(3);
+    string_view time           = c.arg(4);
+    string_view attendance_str = c.arg(5);
+    string      fname(c.arg(6));
+
+    {
+        shared_lock<shared_mutex> ul(users_mtx_);
+        User* u = find_user(uid);
+        if (!u) {
+            send_tcp_line(c, "RCE NLG\n");
+            return;
+        }
+        if (u->password != pass) {
+            send_tcp_line(c, "RCE WRP\n");
+            return;
+        }
+        if (!u->loggedIn) {
+            send_tcp_line(c, "RCE NLG\n");
+            return;
+        }
     }
 
-    int  attendance = -1;
-    long fsize      = -1;
-    try {
-        attendance = stoi(attendance_str);
-        fsize      = stol(fsize_str);
-    } catch (...) {
-        send_tcp_line(fd, "RCE ERR\n");
+    // Validate parameters (checked while the header was lexed)
+    if (!cre_header_valid(c)) {
+        send_tcp_line(c, "RCE ERR\n");
         return;
     }
+    int  attendance = static_cast<int>(c.num[5]);
+    long fsize      = c.num[7];
 
-    const long MAX_FILE_SIZE = 10000000L; // 10 MB
-
-    // Validate parameters
-    if (!valid_event_name(name) ||
-        !valid_event_datetime(date, time) ||
-        attendance < 10 || attendance > 999 ||
-        fsize <= 0 || fsize > MAX_FILE_SIZE) {
-        send_tcp_line(fd, "RCE ERR\n");
+    // Client closed before sending all file data
+    if (c.body_got != static_cast<size_t>(fsize)) {
+        send_tcp_line(c, "RCE NOK\n");
         return;
     }
 
-    // Read file data from client
-    vector<char> data(static_cast<size_t>(fsize));
-    long   remaining = fsize;
-    size_t offset    = 0;
-
-    while (remaining > 0) {
-        ssize_t got = ::read(fd, data.data() + offset,
-                             static_cast<size_t>(remaining));
-        if (got <= 0) {
-            send_tcp_line(fd, "RCE NOK\n");
-            return;
-        }
-        remaining -= got;
-        offset    += static_cast<size_t>(got);
-    }
-
     /*
     // Check event is not in the past
-    Event tmp;
-    tmp.date = date;
-    tmp.time = time;
-    if (compute_event_state(tmp) == 0) {
-        send_tcp_line(fd, "RCE ERR\n");
+    if (event_start(date, time) <= ::time(nullptr)) {
+        send_tcp_line(c, "RCE ERR\n");
         return;
     }
     */
 
-    string eid = allocate_eid();
-    if (eid.empty()) {
-        send_tcp_line(fd, "RCE NOK\n");
+    // Hash and store the upload before taking the table lock (it may be
+    // large); it is synced unless the durability mode is none
+    ::close(c.body_fd);
+    c.body_fd = -1;
+    string blob = c.body_failed ? "" : BlobStore::hash_file(c.body_path);
+    if (blob.empty() ||
+        !blobs_->store(c.body_path, blob, durability_ != Durability::None)) {
+        send_tcp_line(c, "RCE NOK\n");
         return;
     }
+    c.body_path.clear();
 
-    // Save file to disk
-    FILE* fp = fopen(fname.c_str(), "wb");
-    if (!fp) {
-        send_tcp_line(fd, "RCE NOK\n");
-        return;
-    }
-    size_t written = fwrite(data.data(), 1, data.size(), fp);
-    fclose(fp);
-    if (written != data.size()) {
-        send_tcp_line(fd, "RCE NOK\n");
+    shared_lock<shared_mutex> gate(wal_gate_);
+    unique_lock<shared_mutex> el(events_mtx_);
+    string eid = allocate_eid();
+    if (eid.empty()) {
+        send_tcp_line(c, "RCE NOK\n");
         return;
     }
 
@@ -796,164 +2430,211 @@ void EventServer::handle_CRE(int fd) {
     ev.attendance = attendance;
     ev.fname      = fname;
     ev.fsize      = static_cast<unsigned long>(fsize);
+    ev.blob       = blob;
     ev.reserved   = 0;
     ev.closed     = false;
 
-    events_.push_back(ev);
-    save_events();
+    ev.start      = event_start(date, time);
+
+    // Unlogged, the stored blob stays unreferenced until the startup sweep
+    if (!log_mutation({WalOp::EventCreated,
+                       {eid, string(uid), string(name), string(date), string(time),
+                        string(attendance_str), fname, to_string(ev.fsize), blob}})) {
+        send_tcp_line(c, "RCE NOK\n");
+        return;
+    }
+    blobs_->add_ref(blob);
+    Event* e = events_.insert(eid, ev);
+    index_event(*e);
+    schedule_expiry(*e);
+    events_changed();
 
     ostringstream oss;
     oss << "RCE OK " << eid << "\n";
-    send_tcp_line(fd, oss.str());
+    send_tcp_line(c, oss.str());
 }
 
 // Handle list all events request
-void EventServer::handle_LST(int fd) {
-    load_events();
+// (served from a shared buffer rebuilt only after events change)
+void EventServer::handle_LST(Connection& c) {
+    uint64_t version = events_version_.load(memory_order_acquire);
+    shared_ptr<const string> reply, bin;
+    {
+        lock_guard<mutex> lk(lst_mtx_);
+        if (lst_cache_ && lst_version_ == version) {
+            reply = lst_cache_;
+            bin   = lst_bin_cache_;
+        }
+    }
 
-    if (events_.empty()) {
-        send_tcp_line(fd, "RLS NOK\n");
+    if (!reply) {
+        reply = make_shared<string>(build_lst_reply());
+        lock_guard<mutex> lk(lst_mtx_);
+        lst_cache_     = reply;
+        lst_bin_cache_ = nullptr;
+        lst_version_   = version;
+    }
+    if (!c.binary) {
+        send_tcp_shared(c, move(reply));
         return;
     }
 
-    // Sort events by EID
-    vector<const Event*> vec;
-    for (const auto& ev : events_) {
-        vec.push_back(&ev);
+    // Binary clients share a framed copy, encoded once per version
+    if (!bin) {
+        auto frame = make_shared<string>();
+        if (!protocol::encode_binary(*reply, *frame)) *frame = *reply;
+        bin = frame;
+        lock_guard<mutex> lk(lst_mtx_);
+        if (lst_cache_ == reply) lst_bin_cache_ = bin;
     }
+    send_tcp_shared(c, move(bin));
+}
 
-    sort(vec.begin(), vec.end(),
-              [](const Event* a, const Event* b) {
-                  return a->eid < b->eid;
-              });
+// Full RLS reply for the current events table
+string EventServer::build_lst_reply() const {
+    shared_lock<shared_mutex> el(events_mtx_);
+    if (events_.empty()) {
+        return "RLS NOK\n";
+    }
 
-    // Build response with event details
+    // Build response with event details (table order is ascending EID)
     ostringstream oss;
     oss << "RLS OK";
-    for (const Event* ev : vec) {
-        int st = compute_event_state(*ev);
-        oss << " " << ev->eid
-            << " " << ev->name
+    events_.for_each([&](const Event& ev) {
+        int st;
+        {
+            lock_guard<mutex> lk(event_lock(ev.eid));
+            st = compute_event_state(ev);
+        }
+        oss << " " << ev.eid
+            << " " << ev.name
             << " " << st
-            << " " << ev->date
-            << " " << ev->time;
-    }
+            << " " << ev.date
+            << " " << ev.time;
+    });
     oss << "\n";
-    send_tcp_line(fd, oss.str());
+    return oss.str();
 }
 
 // CLS UID password EID
-void EventServer::handle_CLS(int fd) {
-    load_events();
-
-    string uid, pass, eid;
-    if (!read_token(fd, uid) ||
-        !read_token(fd, pass) ||
-        !read_token(fd, eid)) {
-        send_tcp_line(fd, "RCL ERR\n");
+void EventServer::handle_CLS(Connection& c) {
+    if (c.argc < 3) {
+        send_tcp_line(c, "RCL ERR\n");
         return;
     }
+    string_view uid  = c.arg(0);
+    string_view pass = c.arg(1);
+    string_view eid  = c.arg(2);
 
-    User* u = find_user(uid);
-    if (!u) {
-        send_tcp_line(fd, "RCL NOK\n");
-        return;
-    }
-    if (u->password != pass) {
-        send_tcp_line(fd, "RCL NOK\n");
-        return;
-    }
-    if (!u->loggedIn) {
-        send_tcp_line(fd, "RCL NLG\n");
-        return;
+    shared_lock<shared_mutex> gate(wal_gate_);
+    {
+        shared_lock<shared_mutex> ul(users_mtx_);
+        User* u = find_user(uid);
+        if (!u) {
+            send_tcp_line(c, "RCL NOK\n");
+            return;
+        }
+        if (u->password != pass) {
+            send_tcp_line(c, "RCL NOK\n");
+            return;
+        }
+        if (!u->loggedIn) {
+            send_tcp_line(c, "RCL NLG\n");
+            return;
+        }
     }
 
+    shared_lock<shared_mutex> el(events_mtx_);
     Event* ev = find_event(eid);
     if (!ev) {
-        send_tcp_line(fd, "RCL NOE\n");
+        send_tcp_line(c, "RCL NOE\n");
         return;
     }
     if (ev->owner_uid != uid) {
-        send_tcp_line(fd, "RCL EOW\n");
+        send_tcp_line(c, "RCL EOW\n");
         return;
     }
+    unique_lock<mutex> lk(event_lock(eid));
     int st = compute_event_state(*ev);
     if (st == 0) {
-        send_tcp_line(fd, "RCL PST\n");
+        send_tcp_line(c, "RCL PST\n");
         return;
     }
     if (ev->closed) {
-        send_tcp_line(fd, "RCL CLO\n");
+        send_tcp_line(c, "RCL CLO\n");
         return;
     }
     if (ev->reserved >= ev->attendance) {
-        send_tcp_line(fd, "RCL SLD\n");
+        send_tcp_line(c, "RCL SLD\n");
         return;
     }
 
+    if (!log_mutation({WalOp::EventClosed, {string(eid)}})) {
+        send_tcp_line(c, "RCL ERR\n");
+        return;
+    }
     ev->closed = true;
-    save_events();
+    events_changed();
 
-    send_tcp_line(fd, "RCL OK\n");
+    send_tcp_line(c, "RCL OK\n");
 }
 
 // Handle reserve seats request
-void EventServer::handle_RID(int fd) {
-    load_events();
-    load_reservations();
-    string uid, pass, eid, peopleStr;
-    if (!read_token(fd, uid) ||
-        !read_token(fd, pass) ||
-        !read_token(fd, eid) ||
-        !read_token(fd, peopleStr)) {
-        send_tcp_line(fd, "RRI ERR\n");
+void EventServer::handle_RID(Connection& c) {
+    if (c.argc < 4) {
+        send_tcp_line(c, "RRI ERR\n");
         return;
     }
+    string_view uid  = c.arg(0);
+    string_view pass = c.arg(1);
+    string_view eid  = c.arg(2);
 
-    User* u = find_user(uid);
-    if (!u) {
-        send_tcp_line(fd, "RRI NLG\n");
-        return;
-    }
-    if (u->password != pass) {
-        send_tcp_line(fd, "RRI WRP\n");
-        return;
-    }
-    if (!u->loggedIn) {
-        send_tcp_line(fd, "RRI NLG\n");
-        return;
+    shared_lock<shared_mutex> gate(wal_gate_);
+    {
+        shared_lock<shared_mutex> ul(users_mtx_);
+        User* u = find_user(uid);
+        if (!u) {
+            send_tcp_line(c, "RRI NLG\n");
+            return;
+        }
+        if (u->password != pass) {
+            send_tcp_line(c, "RRI WRP\n");
+            return;
+        }
+        if (!u->loggedIn) {
+            send_tcp_line(c, "RRI NLG\n");
+            return;
+        }
     }
 
+    shared_lock<shared_mutex> el(events_mtx_);
     Event* ev = find_event(eid);
     if (!ev) {
-        send_tcp_line(fd, "RRI NOK\n");
+        send_tcp_line(c, "RRI NOK\n");
         return;
     }
 
+    // Seat accounting only serializes reservations for the same event
+    unique_lock<mutex> lk(event_lock(eid));
+
     // Check event state
     int st = compute_event_state(*ev);
     if (st == 0) {
-        send_tcp_line(fd, "RRI PST\n");
+        send_tcp_line(c, "RRI PST\n");
         return;
     }
     if (ev->closed) {
-        send_tcp_line(fd, "RRI CLS\n");
+        send_tcp_line(c, "RRI CLS\n");
         return;
     }
     if (ev->reserved >= ev->attendance) {
-        send_tcp_line(fd, "RRI SLD\n");
+        send_tcp_line(c, "RRI SLD\n");
         return;
     }
 
-    int people = 0;
-    try {
-        people = stoi(peopleStr);
-    } catch (...) {
-        send_tcp_line(fd, "RRI ERR\n");
-        return;
-    }
+    long people = c.num[3];
     if (people < 1 || people > 999) {
-        send_tcp_line(fd, "RRI ERR\n");
+        send_tcp_line(c, "RRI ERR\n");
         return;
     }
 
@@ -962,65 +2643,80 @@ void EventServer::handle_RID(int fd) {
     if (people > available) {
         ostringstream oss;
         oss << "RRI REJ " << available << "\n";
-        send_tcp_line(fd, oss.str());
+        send_tcp_line(c, oss.str());
         return;
     }
 
-    // Accept reservation
-    ev->reserved += people;
-
     Reservation r;
     r.uid = uid;
     r.eid = eid;
-    r.seats = people;
+    r.seats = static_cast<int>(people);
 
     // Generate timestamp
     time_t now = time(nullptr);
-    tm* t = localtime(&now);
+    tm t{};
+    localtime_r(&now, &t);
     char tbuf[64];
-    strftime(tbuf, sizeof(tbuf), "%d-%m-%Y %H:%M:%S", t);
+    strftime(tbuf, sizeof(tbuf), "%d-%m-%Y %H:%M:%S", &t);
     r.timestamp = tbuf;
 
-    reservations_.push_back(r);
-    save_reservations();
-    save_events();
+    if (!log_mutation({WalOp::SeatsReserved,
+                       {r.uid, r.eid, to_string(people),
+                        r.timestamp.substr(0, 10), r.timestamp.substr(11)}})) {
+        send_tcp_line(c, "RRI ERR\n");
+        return;
+    }
+
+    // Accept reservation (LST only shows it once the event sells out)
+    ev->reserved += people;
+    if (ev->reserved >= ev->attendance) events_changed();
+    {
+        lock_guard<mutex> rl(reservations_mtx_);
+        add_reservation(r);
+    }
 
     ostringstream oss;
     oss << "RRI ACC\n";
-    send_tcp_line(fd, oss.str());
+    send_tcp_line(c, oss.str());
 }
 
 // Handle show event details request - send event info and file
-void EventServer::handle_SED(int fd) {
-    load_events();
-
-    string eid;
-    if (!read_token(fd, eid)) {
-        send_tcp_line(fd, "RSE NOK\n");
+void EventServer::handle_SED(Connection& c) {
+    if (c.argc == 0) {
+        send_tcp_line(c, "RSE NOK\n");
         return;
     }
 
-    Event* ev = find_event(eid);
+    shared_lock<shared_mutex> el(events_mtx_);
+    Event* ev = find_event(c.arg(0));
     if (!ev) {
-        send_tcp_line(fd, "RSE NOK\n");
-        return;
-    }
-
-    // Read event file from disk
-    FILE* fp = fopen(ev->fname.c_str(), "rb");
-    if (!fp) {
-        send_tcp_line(fd, "RSE NOK\n");
+        send_tcp_line(c, "RSE NOK\n");
         return;
     }
-    vector<char> data(ev->fsize);
-    size_t rd = fread(data.data(), 1, data.size(), fp);
-    fclose(fp);
-    if (rd != data.size()) {
-        send_tcp_line(fd, "RSE NOK\n");
-        return;
+    int reserved;
+    {
+        lock_guard<mutex> lk(event_lock(ev->eid));
+        reserved = ev->reserved;
+    }
+
+    // Hot files come mapped from the cache; others are opened and their
+    // bytes go from the page cache to the socket. Events from before the
+    // blob store keep their file under fname.
+    string path = ev->blob.empty() ? ev->fname : blobs_->path(ev->blob);
+    shared_ptr<const MappedFile> map = file_cache_->get(path, ev->fsize);
+    int fd = -1;
+    if (!map) {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0 ||
+            static_cast<unsigned long>(st.st_size) < ev->fsize) {
+            if (fd >= 0) ::close(fd);
+            send_tcp_line(c, "RSE NOK\n");
+            return;
+        }
     }
 
-    // Send event metadata and file data
+    // Event metadata, then the file data, then the terminator
     ostringstream oss;
     oss << "RSE OK "
         << ev->owner_uid << " "
@@ -1028,24 +2724,43 @@ void EventServer::handle_SED(int fd) {
         << ev->date      << " "
         << ev->time      << " "
         << ev->attendance << " "
-        << ev->reserved   << " "
+        << reserved       << " "
         << ev->fname      << " "
         << ev->fsize      << " ";
 
-    string header = oss.str();
-    ::write(fd, header.c_str(), header.size());
-
-    // Send file data
-    long remaining = static_cast<long>(ev->fsize);
-    size_t offset  = 0;
-    while (remaining > 0) {
-        ssize_t sent = ::write(fd, data.data() + offset,
-                               static_cast<size_t>(remaining));
-        if (sent <= 0) break;
-        remaining -= sent;
-        offset    += static_cast<size_t>(sent);
+    bool framed = send_tcp_line(c, oss.str());
+    if (map) {
+        send_tcp_mapped(c, move(map));
+    } else {
+        send_tcp_file(c, fd, 0, ev->fsize);
     }
+    if (!framed) send_tcp_line(c, "\n"); // a frame needs no terminator
+}
+
+// KAL: keep the connection open for further requests
+void EventServer::handle_KAL(Connection& c) {
+    c.keep_alive = true;
+    send_tcp_line(c, "RKA OK BIN\n"); // binary frames understood
+}
+
+// LME UID password — the whole myevents list, for lists too long for UDP
+void EventServer::handle_LME(Connection& c) {
+    vector<ListItem> items;
+    string status = c.argc < 2 || !c.arg_valid(0) || !c.arg_valid(1)
+                        ? "ERR"
+                        : my_events(string(c.arg(0)), string(c.arg(1)), "", items);
+    string reply = "RME " + status;
+    for (const auto& item : items) reply += item.text;
+    send_tcp_line(c, reply + "\n");
+}
 
-    const char nl = '\n';
-    ::write(fd, &nl, 1);
+// LMR UID password — the whole myreservations list
+void EventServer::handle_LMR(Connection& c) {
+    vector<ListItem> items;
+    string status = c.argc < 2 || !c.arg_valid(0) || !c.arg_valid(1)
+                        ? "ERR"
+                        : my_reservations(string(c.arg(0)), string(c.arg(1)), "", items);
+    string reply = "RMR " + status;
+    for (const auto& item : items) reply += item.text;
+    send_tcp_line(c, reply + "\n");
 }
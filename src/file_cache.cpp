@@ -0,0 +1,93 @@
+using namespace ::std;
+
+#include "file_cache.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile() {
+    if (data) ::munmap(const_cast<char*>(data), size);
+}
+
+// Map the first size bytes of path (nullptr if it is shorter or unreadable)
+static shared_ptr<const MappedFile> map_file(const string& path, size_t size) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= size) {
+        p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (p == MAP_FAILED) return nullptr;
+
+    auto m  = make_shared<MappedFile>();
+    m->data = static_cast<const char*>(p);
+    m->size = size;
+    return m;
+}
+
+FileCache::FileCache(size_t budget_bytes) : budget_(budget_bytes) {}
+
+shared_ptr<const MappedFile> FileCache::get(const string& path, size_t size) {
+    // One file may take at most a quarter of the budget
+    if (size == 0 || size > budget_ / 4) return nullptr;
+
+    {
+        lock_guard<mutex> lk(mtx_);
+        auto it = index_.find(path);
+        if (it != index_.end() && it->second->second->size == size) {
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->second;
+        }
+        ++misses_;
+    }
+
+    // Map without the lock, so hits on other files are not held up
+    shared_ptr<const MappedFile> m = map_file(path, size);
+    if (!m) return nullptr;
+
+    lock_guard<mutex> lk(mtx_);
+    auto it = index_.find(path);
+    if (it != index_.end()) {
+        // Another thread mapped it meanwhile: use its mapping, ours is dropped
+        if (it->second->second->size == size) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->second;
+        }
+        // Size changed: the file was replaced
+        bytes_ -= it->second->second->size;
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+    lru_.emplace_front(path, m);
+    index_[path] = lru_.begin();
+    bytes_ += size;
+    while (bytes_ > budget_) {
+        bytes_ -= lru_.back().second->size;
+        index_.erase(lru_.back().first);
+        lru_.pop_back(); // in-flight replies keep their own reference
+    }
+    return m;
+}
+
+void FileCache::clear() {
+    lock_guard<mutex> lk(mtx_);
+    lru_.clear();
+    index_.clear();
+    bytes_ = 0;
+}
+
+FileCache::Stats FileCache::stats() const {
+    lock_guard<mutex> lk(mtx_);
+    Stats s;
+    s.entries = index_.size();
+    s.bytes   = bytes_;
+    s.hits    = hits_;
+    s.misses  = misses_;
+    return s;
+}
@@ -0,0 +1,434 @@
+using namespace ::std;
+
+#include "load_gen.hpp"
+#include "protocol.hpp"
+#include "common.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+using BenchClock = chrono::steady_clock;
+
+// Every simulated account uses this password (8 alphanumerics)
+static const char BENCH_PASSWORD[] = "bench123";
+
+// A request unanswered for this long counts as an error
+static const int REPLY_TIMEOUT_MS = 2000;
+
+// Length of the complete reply at the start of buf, or 0 while more
+// bytes are needed; head gets its text form (empty if malformed). The
+// event file after an RSE header is counted but not copied.
+static size_t reply_size(const string& buf, string& head) {
+    head.clear();
+    if (buf.empty()) return 0;
+
+    if (static_cast<uint8_t>(buf[0]) == protocol::BINARY_MAGIC) {
+        size_t size = protocol::frame_size(buf.data(), buf.size());
+        if (size == 0 || buf.size() < size) return 0;
+        if (!protocol::decode_binary(string_view(buf).substr(0, size), head)) {
+            head.clear();
+            return size;
+        }
+        if (head.back() == ' ') { // file data follows, no newline
+            size_t at = head.rfind(' ', head.size() - 2);
+            size += strtoul(head.c_str() + at + 1, nullptr, 10);
+        }
+        return buf.size() >= size ? size : 0;
+    }
+
+    if (buf.compare(0, 7, "RSE OK ") == 0) {
+        // Ten header fields, then the file and a newline
+        size_t pos = 0, fsize_at = 0;
+        for (int field = 0; field < 10; ++field) {
+            fsize_at = pos;
+            pos = buf.find(' ', pos);
+            if (pos == string::npos) return 0;
+            ++pos;
+        }
+        size_t size = pos + strtoul(buf.c_str() + fsize_at, nullptr, 10) + 1;
+        if (buf.size() < size) return 0;
+        head.assign(buf, 0, pos);
+        return size;
+    }
+
+    size_t nl = buf.find('\n');
+    if (nl == string::npos) return 0;
+    head.assign(buf, 0, nl + 1);
+    return nl + 1;
+}
+
+// One simulated user: its sockets, reused buffers and measurements
+struct LoadGenerator::Worker {
+    Worker(const LoadGenerator& gen, uint64_t seed) : gen(gen), rng(seed) {}
+    ~Worker() {
+        if (udp_fd >= 0) ::close(udp_fd);
+        tcp_close();
+    }
+
+    const LoadGenerator& gen;
+    mt19937_64           rng;
+
+    int  udp_fd         = -1;
+    int  tcp_fd         = -1;
+    bool try_keep_alive = true;  // false once the server declines KAL
+    bool keep_alive     = false; // the server keeps tcp_fd open
+    bool binary         = false; // send binary frames
+
+    // Request, its binary form, bytes received and the reply header in
+    // text form, reused by every request
+    string req, wire, in, head;
+
+    vector<uint32_t> latency_us[BENCH_COMMANDS]; // answered requests
+    uint64_t         errors[BENCH_COMMANDS] = {};
+
+    bool udp_open();
+    bool tcp_open();
+    void tcp_close();
+    bool tcp_read_reply();
+
+    // Send req (and a body) and wait for the whole reply, left in head.
+    // False on a timeout or a closed connection.
+    bool udp_exchange();
+    bool tcp_exchange(const char* body, size_t body_len);
+
+    // Issue one command as uid (on eid for RID/SED) and record its
+    // latency, or an error if it went unanswered or drew ERR
+    bool request(BenchCommand cmd, const string& uid, const string& eid);
+
+    void clear_stats() {
+        for (auto& lat : latency_us) lat.clear();
+        fill(begin(errors), end(errors), 0);
+    }
+};
+
+bool LoadGenerator::Worker::udp_open() {
+    udp_fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_fd < 0) return false;
+    if (::connect(udp_fd, reinterpret_cast<const sockaddr*>(&gen.addr_),
+                  sizeof(gen.addr_)) < 0) {
+        ::close(udp_fd);
+        udp_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool LoadGenerator::Worker::udp_exchange() {
+    head.clear();
+    if (udp_fd < 0 && !udp_open()) return false;
+
+    wire.clear();
+    const string& out =
+        binary && protocol::encode_binary(req, wire) ? wire : req;
+    if (::send(udp_fd, out.data(), out.size(), 0) < 0) return false;
+
+    char    buf[2048];
+    ssize_t n = -1;
+    pollfd  pfd{udp_fd, POLLIN, 0};
+    if (::poll(&pfd, 1, REPLY_TIMEOUT_MS) > 0) {
+        n = ::recv(udp_fd, buf, sizeof(buf), 0);
+    }
+    if (n <= 0) {
+        // A late reply must not be taken for the next request's
+        ::close(udp_fd);
+        udp_fd = -1;
+        return false;
+    }
+    in.assign(buf, static_cast<size_t>(n));
+    return reply_size(in, head) != 0;
+}
+
+// Connect, and ask for keep-alive unless the server has declined it
+bool LoadGenerator::Worker::tcp_open() {
+    tcp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (tcp_fd < 0) return false;
+    int one = 1;
+    ::setsockopt(tcp_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(tcp_fd, reinterpret_cast<const sockaddr*>(&gen.addr_),
+                  sizeof(gen.addr_)) < 0) {
+        tcp_close();
+        return false;
+    }
+    if (!gen.opts_.keep_alive || !try_keep_alive) return true;
+
+    string kal = protocol::build_keep_alive();
+    if (!write_all(tcp_fd, kal.data(), kal.size()) || !tcp_read_reply()) {
+        tcp_close();
+        return false;
+    }
+    auto r = protocol::parse_reply(head);
+    if (r.type == "RKA" && r.status == "OK") {
+        keep_alive = true;
+        binary     = gen.opts_.binary && r.rest == "BIN";
+        return true;
+    }
+    tcp_close();
+    if (r.type != "ERR") return false;
+    try_keep_alive = false;
+    return tcp_open();
+}
+
+void LoadGenerator::Worker::tcp_close() {
+    if (tcp_fd >= 0) ::close(tcp_fd);
+    tcp_fd     = -1;
+    keep_alive = false;
+}
+
+// Only one request is outstanding, so nothing past its reply arrives
+bool LoadGenerator::Worker::tcp_read_reply() {
+    in.clear();
+    char buf[65536];
+    while (reply_size(in, head) == 0) {
+        pollfd pfd{tcp_fd, POLLIN, 0};
+        if (::poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0) return false;
+        ssize_t n = ::read(tcp_fd, buf, sizeof(buf));
+        if (n <= 0) return false;
+        in.append(buf, static_cast<size_t>(n));
+    }
+    return true;
+}
+
+bool LoadGenerator::Worker::tcp_exchange(const char* body, size_t body_len) {
+    head.clear();
+    if (tcp_fd < 0 && !tcp_open()) return false;
+
+    wire.clear();
+    const string& out =
+        binary && protocol::encode_binary(req, wire) ? wire : req;
+    bool ok = write_all(tcp_fd, out.data(), out.size()) &&
+              write_all(tcp_fd, body, body_len) &&
+              tcp_read_reply();
+    if (!ok || !keep_alive) tcp_close();
+    return ok;
+}
+
+bool LoadGenerator::Worker::request(BenchCommand cmd, const string& uid,
+                                    const string& eid) {
+    req.clear();
+    const char* body = nullptr;
+    size_t      body_len = 0;
+    bool        udp = false;
+    switch (cmd) {
+    case BenchCommand::LIN:
+        protocol::append_login(req, uid, BENCH_PASSWORD);
+        udp = true;
+        break;
+    case BenchCommand::LME:
+        protocol::append_myevents(req, uid, BENCH_PASSWORD);
+        udp = true;
+        break;
+    case BenchCommand::LMR:
+        protocol::append_myreservations(req, uid, BENCH_PASSWORD);
+        udp = true;
+        break;
+    case BenchCommand::CRE:
+        protocol::append_create_header(req, uid, BENCH_PASSWORD, "bench",
+                                       "01-01-2099", "20:00", 999,
+                                       "flyer.txt", static_cast<long>(gen.file_.size()));
+        body     = gen.file_.data();
+        body_len = gen.file_.size();
+        break;
+    case BenchCommand::LST:
+        protocol::append_list(req);
+        break;
+    case BenchCommand::RID:
+        protocol::append_reserve(req, uid, BENCH_PASSWORD, eid, 1);
+        break;
+    case BenchCommand::SED:
+        protocol::append_show(req, eid);
+        break;
+    }
+
+    auto start = BenchClock::now();
+    bool ok    = udp ? udp_exchange() : tcp_exchange(body, body_len);
+    auto took  = chrono::duration_cast<chrono::microseconds>(
+                     BenchClock::now() - start).count();
+
+    size_t i = static_cast<size_t>(cmd);
+    auto   r = protocol::parse_reply(head);
+    if (!ok || r.type.empty() || r.type == "ERR" || r.status == "ERR") {
+        ++errors[i];
+        return false;
+    }
+    latency_us[i].push_back(static_cast<uint32_t>(took));
+    return true;
+}
+
+LoadGenerator::LoadGenerator(const LoadOptions& opts)
+    : opts_(opts) {}
+
+LoadGenerator::~LoadGenerator() = default;
+
+bool LoadGenerator::resolve() {
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    string portStr = to_string(opts_.port);
+    int err = ::getaddrinfo(opts_.server_ip.c_str(), portStr.c_str(), &hints, &res);
+    if (err != 0) {
+        cerr << "[loadgen] getaddrinfo: " << gai_strerror(err) << "\n";
+        return false;
+    }
+    addr_ = *reinterpret_cast<const sockaddr_in*>(res->ai_addr);
+    ::freeaddrinfo(res);
+    return true;
+}
+
+// Register and log in the population and create the events, each
+// worker taking every n-th user and event. Events already listed by the
+// server (from an earlier run) are reused first, so repeated runs do not
+// fill its 999-entry event table.
+bool LoadGenerator::setup() {
+    uids_.clear();
+    for (int i = 0; i < opts_.users; ++i) uids_.push_back(to_string(100000 + i));
+    eids_.assign(static_cast<size_t>(opts_.events), "");
+    file_.assign(static_cast<size_t>(opts_.file_size), 'x');
+
+    random_device seed;
+    workers_.clear();
+    for (int w = 0; w < opts_.connections; ++w) {
+        workers_.push_back(make_unique<Worker>(*this, (uint64_t{seed()} << 32) | seed()));
+    }
+
+    Worker& first = *workers_[0];
+    if (!first.request(BenchCommand::LST, "", "")) {
+        cerr << "[loadgen] no reply from server (TCP)\n";
+        return false;
+    }
+    size_t existing = 0;
+    auto   listed   = protocol::parse_reply(first.head);
+    string_view rec[5]; // EID, name, state, date, time
+    while (existing < eids_.size() && listed.next(rec)) {
+        eids_[existing++] = string(rec[0]);
+    }
+
+    atomic<bool> failed{false};
+    auto prepare = [&](size_t w) {
+        Worker& wk = *workers_[w];
+        size_t  n  = workers_.size();
+        // Connecting negotiates keep-alive and binary frames
+        if (wk.tcp_fd < 0 && !wk.tcp_open()) {
+            cerr << "[loadgen] could not connect to the server (TCP)\n";
+            failed = true;
+            return;
+        }
+        if (!wk.keep_alive) wk.tcp_close();
+
+        for (size_t i = w; i < uids_.size() && !failed; i += n) {
+            bool ok = wk.request(BenchCommand::LIN, uids_[i], "");
+            auto r  = protocol::parse_reply(wk.head);
+            if (!ok || (r.status != "OK" && r.status != "REG")) {
+                cerr << "[loadgen] login of " << uids_[i] << " failed: "
+                     << (ok ? wk.head : "no reply\n");
+                failed = true;
+            }
+        }
+        for (size_t j = existing + w; j < eids_.size() && !failed; j += n) {
+            bool ok = wk.request(BenchCommand::CRE, uids_[j % uids_.size()], "");
+            auto r  = protocol::parse_reply(wk.head);
+            if (!ok || r.status != "OK") {
+                cerr << "[loadgen] create failed (event table full?): "
+                     << (ok ? wk.head : "no reply\n");
+                failed = true;
+                return;
+            }
+            eids_[j] = string(r.rest);
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t w = 0; w < workers_.size(); ++w) threads.emplace_back(prepare, w);
+    for (auto& t : threads) t.join();
+
+    for (auto& wk : workers_) wk->clear_stats();
+    return !failed;
+}
+
+bool LoadGenerator::run() {
+    if (!resolve() || !setup()) return false;
+
+    // Event k (from 0) is picked with weight 1 / (k + 1)^s
+    vector<double> popularity;
+    for (size_t k = 0; k < eids_.size(); ++k) {
+        popularity.push_back(1.0 / pow(static_cast<double>(k + 1), opts_.zipf_s));
+    }
+
+    auto start    = BenchClock::now();
+    auto deadline = start + chrono::seconds(opts_.seconds);
+
+    auto drive = [&](Worker& wk) {
+        discrete_distribution<size_t> pick(begin(opts_.weights), end(opts_.weights));
+        discrete_distribution<size_t> event(popularity.begin(), popularity.end());
+        uniform_int_distribution<size_t> user(0, uids_.size() - 1);
+        while (BenchClock::now() < deadline) {
+            auto cmd = static_cast<BenchCommand>(pick(wk.rng));
+            wk.request(cmd, uids_[user(wk.rng)], eids_[event(wk.rng)]);
+        }
+    };
+
+    vector<thread> threads;
+    for (auto& wk : workers_) threads.emplace_back(drive, ref(*wk));
+    for (auto& t : threads) t.join();
+
+    report(chrono::duration<double>(BenchClock::now() - start).count());
+    return true;
+}
+
+// One report line: answered requests, their rate and latency
+// percentiles (microseconds), and errors
+static void print_row(const char* name, vector<uint32_t>& lat,
+                      uint64_t errors, double seconds) {
+    sort(lat.begin(), lat.end());
+    auto pct = [&](double q) -> uint32_t {
+        if (lat.empty()) return 0;
+        return lat[min(lat.size() - 1, static_cast<size_t>(q * lat.size()))];
+    };
+    cout << left << setw(6) << name << right
+         << setw(10) << lat.size()
+         << setw(11) << fixed << setprecision(1) << lat.size() / seconds
+         << setw(9)  << pct(0.50)
+         << setw(9)  << pct(0.99)
+         << setw(9)  << pct(0.999)
+         << setw(9)  << errors << "\n";
+}
+
+void LoadGenerator::report(double seconds) const {
+    bool binary = !workers_.empty() && workers_[0]->binary;
+    cout << opts_.connections << " users for " << fixed << setprecision(1)
+         << seconds << " s; " << uids_.size() << " accounts, "
+         << eids_.size() << " events (Zipf s=" << setprecision(2)
+         << opts_.zipf_s << "), "
+         << (opts_.keep_alive ? "KAL" : "one connection per request")
+         << (binary ? ", binary frames" : "") << "\n\n";
+    cout << "cmd        count      req/s   p50 us   p99 us  p999 us   errors\n";
+
+    vector<uint32_t> all, lat;
+    uint64_t total_errors = 0;
+    for (size_t c = 0; c < BENCH_COMMANDS; ++c) {
+        lat.clear();
+        uint64_t errors = 0;
+        for (const auto& wk : workers_) {
+            lat.insert(lat.end(), wk->latency_us[c].begin(), wk->latency_us[c].end());
+            errors += wk->errors[c];
+        }
+        if (lat.empty() && errors == 0) continue;
+        all.insert(all.end(), lat.begin(), lat.end());
+        total_errors += errors;
+        print_row(BENCH_COMMAND_NAMES[c], lat, errors, seconds);
+    }
+    print_row("all", all, total_errors, seconds);
+}
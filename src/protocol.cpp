@@ -2,138 +2,563 @@ using namespace ::std;
 
 #include "protocol.hpp"
 
-#include <cstdio>
-#include <sstream>
+#include <cctype>
+#include <cstring>
+#include <charconv>
 
 namespace protocol {
 
+// ---------- Formatting ----------
+
+// " <field>"
+static void append_field(string& out, string_view field) {
+    out += ' ';
+    out.append(field.data(), field.size());
+}
+
+// " <prefix><v>" (prefix may be '\0' for none)
+static void append_number(string& out, long long v, char prefix = '\0') {
+    char buf[24];
+    char* end = to_chars(buf, buf + sizeof(buf), v).ptr;
+    out += ' ';
+    if (prefix) out += prefix;
+    out.append(buf, end);
+}
+
 // ---------- UDP builders ----------
 
-// Build login request message
-string build_login(const string& uid, const string& pass) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "LIN %s %s\n", uid.c_str(), pass.c_str());
-    return string(buf);
+// "<cmd> <uid> <pass>[ @<cursor>][ #<rid>]\n"
+static void append_udp(string& out, const char* cmd, string_view uid,
+                       string_view pass, uint32_t rid, string_view cursor = {}) {
+    out += cmd;
+    append_field(out, uid);
+    append_field(out, pass);
+    if (!cursor.empty()) {
+        out += " @";
+        out.append(cursor.data(), cursor.size());
+    }
+    if (rid != 0) append_number(out, rid, '#');
+    out += '\n';
 }
 
-// Build logout request message
-string build_logout(const string& uid, const string& pass) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "LOU %s %s\n", uid.c_str(), pass.c_str());
-    return string(buf);
+void append_login(string& out, string_view uid, string_view pass, uint32_t rid) {
+    append_udp(out, "LIN", uid, pass, rid);
 }
 
-// Build unregister request message
-string build_unregister(const string& uid, const string& pass) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "UNR %s %s\n", uid.c_str(), pass.c_str());
-    return string(buf);
+void append_logout(string& out, string_view uid, string_view pass, uint32_t rid) {
+    append_udp(out, "LOU", uid, pass, rid);
 }
 
-// Build list my events request message
-string build_myevents(const string& uid, const string& pass) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "LME %s %s\n", uid.c_str(), pass.c_str());
-    return string(buf);
+void append_unregister(string& out, string_view uid, string_view pass, uint32_t rid) {
+    append_udp(out, "UNR", uid, pass, rid);
 }
 
-// Build list my reservations request message
-string build_myreservations(const string& uid, const string& pass) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "LMR %s %s\n", uid.c_str(), pass.c_str());
-    return string(buf);
+void append_myevents(string& out, string_view uid, string_view pass,
+                     uint32_t rid, string_view cursor) {
+    append_udp(out, "LME", uid, pass, rid, cursor);
+}
+
+void append_myreservations(string& out, string_view uid, string_view pass,
+                           uint32_t rid, string_view cursor) {
+    append_udp(out, "LMR", uid, pass, rid, cursor);
 }
 
 // ---------- TCP builders ----------
 
-// Build change password request message
-string build_change_pass(const string& uid,
-                              const string& oldPass,
-                              const string& newPass) {
-    char buf[128];
-    snprintf(buf, sizeof(buf),
-                  "CPS %s %s %s\n",
-                  uid.c_str(), oldPass.c_str(), newPass.c_str());
-    return string(buf);
+// "CPS <uid> <old> <new>\n"
+void append_change_pass(string& out, string_view uid,
+                        string_view oldPass, string_view newPass) {
+    out += "CPS";
+    append_field(out, uid);
+    append_field(out, oldPass);
+    append_field(out, newPass);
+    out += '\n';
 }
 
-// Build create event header (without file data)
-string build_create_header(const string& uid,
-                                const string& pass,
-                                const string& name,
-                                const string& date,
-                                const string& time,
-                                int attendance,
-                                const string& fname,
-                                long fsize) {
-    char buf[256];
+// "CRE <uid> <pass> <name> <date> <time> <attendance> <fname> <fsize> "
+// (the file data follows)
+void append_create_header(string& out, string_view uid, string_view pass,
+                          string_view name, string_view date, string_view time,
+                          int attendance, string_view fname, long fsize) {
+    out += "CRE";
+    append_field(out, uid);
+    append_field(out, pass);
+    append_field(out, name);
+    append_field(out, date);
+    append_field(out, time);
+    append_number(out, attendance);
+    append_field(out, fname);
+    append_number(out, fsize);
+    out += ' ';
+}
 
+void append_list(string& out) {
+    out += "LST\n";
+}
 
-    snprintf(buf, sizeof(buf),
-                  "CRE %s %s %s %s %s %d %s %ld ",
-                  uid.c_str(),
-                  pass.c_str(),
-                  name.c_str(),
-                  date.c_str(),
-                  time.c_str(),
-                  attendance,
-                  fname.c_str(),
-                  fsize);
+// "CLS <uid> <pass> <eid>\n"
+void append_close(string& out, string_view uid, string_view pass, string_view eid) {
+    out += "CLS";
+    append_field(out, uid);
+    append_field(out, pass);
+    append_field(out, eid);
+    out += '\n';
+}
 
-    return string(buf);
+// "RID <uid> <pass> <eid> <seats>\n"
+void append_reserve(string& out, string_view uid, string_view pass,
+                    string_view eid, int people) {
+    out += "RID";
+    append_field(out, uid);
+    append_field(out, pass);
+    append_field(out, eid);
+    append_number(out, people);
+    out += '\n';
 }
 
+// "SED <eid>\n"
+void append_show(string& out, string_view eid) {
+    out += "SED";
+    append_field(out, eid);
+    out += '\n';
+}
 
+void append_keep_alive(string& out) {
+    out += "KAL\n";
+}
+
+// ---------- String builders ----------
+
+string build_login(const string& uid, const string& pass, uint32_t rid) {
+    string out;
+    append_login(out, uid, pass, rid);
+    return out;
+}
+
+string build_logout(const string& uid, const string& pass, uint32_t rid) {
+    string out;
+    append_logout(out, uid, pass, rid);
+    return out;
+}
+
+string build_unregister(const string& uid, const string& pass, uint32_t rid) {
+    string out;
+    append_unregister(out, uid, pass, rid);
+    return out;
+}
+
+string build_myevents(const string& uid, const string& pass, uint32_t rid,
+                      const string& cursor) {
+    string out;
+    append_myevents(out, uid, pass, rid, cursor);
+    return out;
+}
+
+string build_myreservations(const string& uid, const string& pass, uint32_t rid,
+                            const string& cursor) {
+    string out;
+    append_myreservations(out, uid, pass, rid, cursor);
+    return out;
+}
+
+string build_change_pass(const string& uid, const string& oldPass,
+                         const string& newPass) {
+    string out;
+    append_change_pass(out, uid, oldPass, newPass);
+    return out;
+}
+
+string build_create_header(const string& uid, const string& pass,
+                           const string& name, const string& date,
+                           const string& time, int attendance,
+                           const string& fname, long fsize) {
+    string out;
+    append_create_header(out, uid, pass, name, date, time, attendance, fname, fsize);
+    return out;
+}
 
-// Build list all events request message
 string build_list() {
-    return "LST\n";
+    string out;
+    append_list(out);
+    return out;
 }
 
-// Build close event request message
-string build_close(const string& uid,
-                        const string& pass,
-                        const string& eid) {
-    char buf[64];
-    snprintf(buf, sizeof(buf),
-                  "CLS %s %s %s\n",
-                  uid.c_str(), pass.c_str(), eid.c_str());
-    return string(buf);
+string build_close(const string& uid, const string& pass, const string& eid) {
+    string out;
+    append_close(out, uid, pass, eid);
+    return out;
 }
 
-// Build reserve seats request message
-string build_reserve(const string& uid,
-                          const string& pass,
-                          const string& eid,
-                          int people) {
-    char buf[128];
-    snprintf(buf, sizeof(buf),
-                  "RID %s %s %s %d\n",
-                  uid.c_str(), pass.c_str(), eid.c_str(), people);
-    return string(buf);
+string build_reserve(const string& uid, const string& pass,
+                     const string& eid, int people) {
+    string out;
+    append_reserve(out, uid, pass, eid, people);
+    return out;
 }
 
-// Build show event details request message
 string build_show(const string& eid) {
-    char buf[32];
-    snprintf(buf, sizeof(buf), "SED %s\n", eid.c_str());
-    return string(buf);
-}
-
-
-// Parse server response into type, status and remaining data
-ResponseLine parse_response_line(const string& line) {
-    ResponseLine r;
-    istringstream iss(line);
-    iss >> r.type >> r.status;
-    string rest;
-    getline(iss, rest);
-    // Remove leading space
-    if (!rest.empty() && rest[0] == ' ') {
-        rest.erase(0, 1);
-    }
-    r.rest = rest;
+    string out;
+    append_show(out, eid);
+    return out;
+}
+
+string build_keep_alive() {
+    string out;
+    append_keep_alive(out);
+    return out;
+}
+
+// ---------- Replies ----------
+
+static bool is_space(char ch) {
+    return isspace(static_cast<unsigned char>(ch)) != 0;
+}
+
+// Take the first whitespace-separated token off s
+static bool take_token(string_view& s, string_view& tok) {
+    size_t start = 0;
+    while (start < s.size() && is_space(s[start])) ++start;
+    size_t end = start;
+    while (end < s.size() && !is_space(s[end])) ++end;
+    tok = s.substr(start, end - start);
+    s   = s.substr(end);
+    return !tok.empty();
+}
+
+bool Reply::next(string_view& tok) {
+    return take_token(rest, tok);
+}
+
+// Split "<type> <status> <rest>\n" in place
+Reply parse_reply(string_view line) {
+    Reply r;
+    r.rest = line;
+    r.next(r.type);
+    r.next(r.status);
+    size_t start = 0;
+    while (start < r.rest.size() && is_space(r.rest[start])) ++start;
+    size_t end = r.rest.size();
+    while (end > start && is_space(r.rest[end - 1])) --end;
+    r.rest = r.rest.substr(start, end - start);
     return r;
 }
 
+// ---------- Binary framing ----------
+
+namespace {
+
+enum class Field : uint8_t { None, Uid, Eid, Num, Size, State, Status, Rid, Cursor, Text };
+
+struct FieldSpec {
+    Field  kind;
+    size_t width; // bytes in the frame
+};
+
+constexpr FieldSpec UID{Field::Uid, 4},       EID{Field::Eid, 2};
+constexpr FieldSpec NUM{Field::Num, 4},       SIZE{Field::Size, 8};
+constexpr FieldSpec STATE{Field::State, 1},   STATUS{Field::Status, 1};
+constexpr FieldSpec RID{Field::Rid, 4},       CURSOR{Field::Cursor, 16};
+constexpr FieldSpec PASS{Field::Text, 8},     NAME{Field::Text, 10};
+constexpr FieldSpec DATE{Field::Text, 10},    TIME{Field::Text, 8}; // hh:mm[:ss]
+constexpr FieldSpec CLOCK{Field::Text, 8},    FNAME{Field::Text, 24};
+constexpr FieldSpec WORD{Field::Text, 8};
+
+// Field layout of each message; the op is the index in MESSAGES. Fields
+// after a reply's status may be absent ("RCE NOK"); a list (records of
+// 'group' fields) and a paging cursor follow the head fields.
+struct MessageSpec {
+    const char* type;
+    FieldSpec   head[9];
+    FieldSpec   group[5];
+    bool        cursor;
+};
+
+const MessageSpec MESSAGES[] = {
+    {"LIN", {UID, PASS, RID}, {}, false},
+    {"LOU", {UID, PASS, RID}, {}, false},
+    {"UNR", {UID, PASS, RID}, {}, false},
+    {"LME", {UID, PASS, CURSOR, RID}, {}, false},
+    {"LMR", {UID, PASS, CURSOR, RID}, {}, false},
+    {"CPS", {UID, PASS, PASS}, {}, false},
+    {"CRE", {UID, PASS, NAME, DATE, TIME, NUM, FNAME, SIZE}, {}, false},
+    {"LST", {}, {}, false},
+    {"CLS", {UID, PASS, EID}, {}, false},
+    {"RID", {UID, PASS, EID, NUM}, {}, false},
+    {"SED", {EID}, {}, false},
+    {"KAL", {}, {}, false},
+    {"RLI", {STATUS}, {}, false},
+    {"RLO", {STATUS}, {}, false},
+    {"RUR", {STATUS}, {}, false},
+    {"RCP", {STATUS}, {}, false},
+    {"RCL", {STATUS}, {}, false},
+    {"RCE", {STATUS, EID}, {}, false},
+    {"RRI", {STATUS, NUM}, {}, false},
+    {"RLS", {STATUS}, {EID, NAME, STATE, DATE, TIME}, false},
+    {"RME", {STATUS}, {EID, STATE}, true},
+    {"RMR", {STATUS}, {EID, DATE, CLOCK, NUM}, true},
+    {"RSE", {STATUS, UID, NAME, DATE, TIME, NUM, NUM, FNAME, SIZE}, {}, false},
+    {"RKA", {STATUS, WORD}, {}, false},
+    {"ERR", {}, {}, false},
+};
+
+const char* const STATUSES[] = {
+    "OK", "NOK", "ERR", "NLG", "WRP", "UNR", "REG", "NID", "NOE",
+    "EOW", "PST", "CLO", "CLS", "SLD", "ACC", "REJ", "TCP",
+};
+
+template <typename T>
+void put_int(string& out, T v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename T>
+T get_int(const char* p) {
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Decimal token (digits only, exactly 'digits' of them unless 0)
+template <typename T>
+bool parse_uint(string_view tok, T& v, size_t digits = 0) {
+    if (tok.empty() || (digits && tok.size() != digits)) return false;
+    for (char ch : tok)
+        if (ch < '0' || ch > '9') return false;
+    auto [end, ec] = from_chars(tok.data(), tok.data() + tok.size(), v);
+    return ec == errc() && end == tok.data() + tok.size();
+}
+
+// " <v>", zero-padded to 'digits'
+void append_uint(string& text, uint64_t v, size_t digits = 0) {
+    char buf[24];
+    char* end = to_chars(buf, buf + sizeof(buf), v).ptr;
+    text += ' ';
+    for (size_t n = static_cast<size_t>(end - buf); n < digits; ++n) text += '0';
+    text.append(buf, end);
+}
+
+// Text of a NUL-padded field: one token of printable characters
+bool get_text(const char* p, size_t width, string_view& s) {
+    size_t n = 0;
+    while (n < width && p[n] != '\0') ++n;
+    s = string_view(p, n);
+    for (char ch : s)
+        if (static_cast<unsigned char>(ch) <= ' ' || ch == 0x7f) return false;
+    return true;
+}
+
+bool put_text(string& out, string_view s, size_t width) {
+    if (s.size() > width) return false;
+    out.append(s.data(), s.size());
+    out.append(width - s.size(), '\0');
+    return true;
+}
+
+bool encode_field(const FieldSpec& f, string_view tok, string& out) {
+    switch (f.kind) {
+    case Field::Uid:  { uint32_t v; return parse_uint(tok, v, 6) && (put_int(out, v), true); }
+    case Field::Eid:  { uint16_t v; return parse_uint(tok, v, 3) && (put_int(out, v), true); }
+    case Field::Num:
+    case Field::Rid:  { uint32_t v; return parse_uint(tok, v) && (put_int(out, v), true); }
+    case Field::Size: { uint64_t v; return parse_uint(tok, v) && (put_int(out, v), true); }
+    case Field::State: {
+        uint8_t v;
+        return parse_uint(tok, v, 1) && (put_int(out, v), true);
+    }
+    case Field::Status:
+        for (size_t i = 0; i < size(STATUSES); ++i) {
+            if (tok == STATUSES[i]) {
+                put_int(out, static_cast<uint8_t>(i));
+                return true;
+            }
+        }
+        return false;
+    case Field::Cursor:
+    case Field::Text:
+        return put_text(out, tok, f.width);
+    case Field::None:
+        break;
+    }
+    return false;
+}
+
+// Append " <field>" (nothing for an absent request ID or cursor)
+bool decode_field(const FieldSpec& f, const char* p, string& text) {
+    switch (f.kind) {
+    case Field::Uid: {
+        uint32_t v = get_int<uint32_t>(p);
+        if (v > 999999) return false;
+        append_uint(text, v, 6);
+        return true;
+    }
+    case Field::Eid: {
+        uint16_t v = get_int<uint16_t>(p);
+        if (v > 999) return false;
+        append_uint(text, v, 3);
+        return true;
+    }
+    case Field::Num:   append_uint(text, get_int<uint32_t>(p)); return true;
+    case Field::Size:  append_uint(text, get_int<uint64_t>(p)); return true;
+    case Field::State: append_uint(text, get_int<uint8_t>(p));  return true;
+    case Field::Status: {
+        uint8_t v = get_int<uint8_t>(p);
+        if (v >= size(STATUSES)) return false;
+        text += ' ';
+        text += STATUSES[v];
+        return true;
+    }
+    case Field::Rid: {
+        uint32_t v = get_int<uint32_t>(p);
+        if (v != 0) append_number(text, v, '#');
+        return true;
+    }
+    case Field::Cursor:
+    case Field::Text: {
+        string_view s;
+        if (!get_text(p, f.width, s)) return false;
+        if (s.empty()) return f.kind == Field::Cursor;
+        text += f.kind == Field::Cursor ? " @" : " ";
+        text += s;
+        return true;
+    }
+    case Field::None:
+        break;
+    }
+    return false;
+}
+
+size_t group_width(const MessageSpec& spec) {
+    size_t w = 0;
+    for (const auto& f : spec.group) w += f.width;
+    return w;
+}
+
+} // namespace
+
+size_t frame_size(const char* p, size_t n) {
+    if (n < FRAME_HEADER) return 0;
+    return FRAME_HEADER + get_int<uint32_t>(p + 2);
+}
+
+bool encode_binary(string_view text, string& out) {
+    string_view rest = text, tok;
+    if (!take_token(rest, tok)) return false;
+
+    size_t op = 0;
+    while (op < size(MESSAGES) && tok != MESSAGES[op].type) ++op;
+    if (op == size(MESSAGES)) return false;
+    const MessageSpec& spec = MESSAGES[op];
+
+    size_t mark = out.size();
+    out += static_cast<char>(BINARY_MAGIC);
+    out += static_cast<char>(op);
+    put_int(out, uint32_t{0}); // payload size, set below
+
+    bool ok = true;
+    for (const auto& f : spec.head) {
+        if (f.kind == Field::None) break;
+        string_view after = rest;
+        bool have = take_token(after, tok);
+        // Optional tokens, always present in the frame (empty or 0)
+        char mark_char = f.kind == Field::Rid ? '#' : f.kind == Field::Cursor ? '@' : 0;
+        if (mark_char) {
+            if (have && tok[0] == mark_char) {
+                rest = after;
+                ok = ok && encode_field(f, tok.substr(1), out);
+            } else {
+                out.append(f.width, '\0');
+            }
+            continue;
+        }
+        if (!have) break;
+        rest = after;
+        ok = ok && encode_field(f, tok, out);
+    }
+
+    string_view probe = rest;
+    if (spec.group[0].kind != Field::None && take_token(probe, tok)) {
+        // A trailing "@<cursor>" token is the paging cursor
+        size_t end = rest.size();
+        while (end > 0 && is_space(rest[end - 1])) --end;
+        size_t last = end;
+        while (last > 0 && !is_space(rest[last - 1])) --last;
+        string_view cursor;
+        if (spec.cursor && rest[last] == '@') {
+            cursor = rest.substr(last + 1, end - last - 1);
+            end    = last;
+        }
+        string_view items = rest.substr(0, end);
+
+        size_t per = 0;
+        while (per < size(spec.group) && spec.group[per].kind != Field::None) ++per;
+        size_t count = 0;
+        for (string_view s = items; take_token(s, tok); ) ++count;
+        ok = ok && count % per == 0;
+        put_int(out, static_cast<uint32_t>(count / per));
+        for (size_t k = 0; ok && take_token(items, tok); ++k)
+            ok = encode_field(spec.group[k % per], tok, out);
+        if (spec.cursor) ok = ok && put_text(out, cursor, CURSOR.width);
+        rest = {};
+    }
+
+    if (!ok || take_token(rest, tok)) {
+        out.resize(mark);
+        return false;
+    }
+    uint32_t len = static_cast<uint32_t>(out.size() - mark - FRAME_HEADER);
+    memcpy(&out[mark + 2], &len, sizeof(len));
+    return true;
+}
+
+bool decode_binary(string_view frame, string& text) {
+    if (frame.size() < FRAME_HEADER ||
+        static_cast<uint8_t>(frame[0]) != BINARY_MAGIC ||
+        frame_size(frame.data(), frame.size()) != frame.size())
+        return false;
+    size_t op = static_cast<uint8_t>(frame[1]);
+    if (op >= size(MESSAGES)) return false;
+    const MessageSpec& spec = MESSAGES[op];
+
+    const char* p   = frame.data() + FRAME_HEADER;
+    const char* end = frame.data() + frame.size();
+    size_t mark = text.size();
+    text += spec.type;
+    bool ok   = true;
+    bool data = false; // ended with the file size: file data follows
+
+    for (const auto& f : spec.head) {
+        if (f.kind == Field::None || static_cast<size_t>(end - p) < f.width) break;
+        ok = ok && decode_field(f, p, text);
+        p   += f.width;
+        data = f.kind == Field::Size;
+    }
+
+    size_t width = group_width(spec);
+    if (ok && width > 0 && p != end) {
+        size_t tail = spec.cursor ? CURSOR.width : 0;
+        ok = end - p >= 4;
+        uint32_t count = ok ? get_int<uint32_t>(p) : 0;
+        if (ok) p += 4;
+        ok = ok && static_cast<size_t>(end - p) == count * width + tail;
+        for (uint32_t k = 0; ok && k < count; ++k) {
+            for (const auto& f : spec.group) {
+                if (f.kind == Field::None) break;
+                ok = ok && decode_field(f, p, text);
+                p += f.width;
+            }
+        }
+        if (ok && spec.cursor) {
+            ok = decode_field(CURSOR, p, text);
+            p += CURSOR.width;
+        }
+    }
+
+    if (!ok || p != end) {
+        text.resize(mark);
+        return false;
+    }
+    text += data ? ' ' : '\n';
+    return true;
+}
+
 }
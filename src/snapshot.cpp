@@ -0,0 +1,57 @@
+using namespace ::std;
+
+#include "snapshot.hpp"
+
+#include <cstring>
+
+namespace snapshot {
+
+// Reflected CRC-32 lookup table (polynomial 0xEDB88320)
+static const uint32_t* crc_table() {
+    static uint32_t table[256];
+    static bool ready = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+uint32_t crc32(const void* data, size_t len, uint32_t crc) {
+    const uint32_t* table = crc_table();
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    while (len--) crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+string assemble(const string& users, uint64_t nusers,
+                const string& events, uint64_t nevents,
+                const string& reservations, uint64_t nreservations,
+                uint64_t wal_next) {
+    Header h{};
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version      = VERSION;
+    h.users        = nusers;
+    h.events       = nevents;
+    h.reservations = nreservations;
+    h.wal_next     = wal_next;
+    h.crc = crc32(users.data(), users.size());
+    h.crc = crc32(events.data(), events.size(), h.crc);
+    h.crc = crc32(reservations.data(), reservations.size(), h.crc);
+
+    string out;
+    out.reserve(sizeof(h) + users.size() + events.size() + reservations.size());
+    out.append(reinterpret_cast<const char*>(&h), sizeof(h));
+    out += users;
+    out += events;
+    out += reservations;
+    return out;
+}
+
+} // namespace snapshot
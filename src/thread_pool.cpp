@@ -0,0 +1,43 @@
+using namespace ::std;
+
+#include "thread_pool.hpp"
+
+// Start the worker threads
+ThreadPool::ThreadPool(size_t threads) {
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back([this] { worker_loop(); });
+    }
+}
+
+// Finish queued tasks, then join every worker
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lk(mtx_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_) t.join();
+}
+
+// Queue a task for the next idle worker
+void ThreadPool::submit(function<void()> task) {
+    {
+        lock_guard<mutex> lk(mtx_);
+        tasks_.push_back(move(task));
+    }
+    cv_.notify_one();
+}
+
+void ThreadPool::worker_loop() {
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lk(mtx_);
+            cv_.wait(lk, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) return;
+            task = move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
@@ -2,6 +2,7 @@ using namespace ::std;
 
 #include "user_client.hpp"
 #include "protocol.hpp"
+#include "common.hpp"
 
 #include <iostream>
 #include <sstream>
@@ -9,11 +10,37 @@ using namespace ::std;
 #include <cstdio>
 #include <vector>
 #include <algorithm>
+#include <random>
 
 #include <sys/socket.h>
+#include <poll.h>
 #include <netdb.h>
 #include <unistd.h>
 
+// UDP retransmission: first wait, doubled after each unanswered attempt
+static const int UDP_FIRST_WAIT_MS = 200;
+static const int UDP_ATTEMPTS      = 5;   // about 6 s in total
+
+// Whether a reply has fully arrived: a text line, or a binary frame
+static bool reply_complete(const string& reply) {
+    if (reply.empty()) return false;
+    if (static_cast<uint8_t>(reply[0]) != protocol::BINARY_MAGIC) {
+        return reply.back() == '\n';
+    }
+    size_t size = protocol::frame_size(reply.data(), reply.size());
+    return size != 0 && reply.size() >= size;
+}
+
+// Text form of a reply ("" if a frame is malformed)
+static string reply_text(const string& reply) {
+    if (reply.empty() || static_cast<uint8_t>(reply[0]) != protocol::BINARY_MAGIC) {
+        return reply;
+    }
+    string text;
+    protocol::decode_binary(reply, text);
+    return text;
+}
+
 // Read a line from TCP socket
 static string tcp_read_line(int sockfd) {
     string line;
@@ -37,7 +64,18 @@ static string state_to_status(const string& state_token) {
 }
 
 UserClient::UserClient(const string& serverIp, int serverPort)
-    : serverIp_(serverIp), serverPort_(serverPort) {}
+    : serverIp_(serverIp), serverPort_(serverPort),
+      next_rid_(random_device{}()) {}
+
+UserClient::~UserClient() {
+    if (tcp_fd_ >= 0) ::close(tcp_fd_);
+}
+
+// Fresh non-zero ID for a UDP request (shared by its retransmissions)
+uint32_t UserClient::next_request_id() {
+    if (++next_rid_ == 0) ++next_rid_;
+    return next_rid_;
+}
 
 void UserClient::print_help() const {
     cout << "Commands\n"
@@ -63,6 +101,10 @@ void UserClient::run() {
 
     print_help();
 
+    // Learn early whether the server takes binary frames (also for UDP)
+    tcp_connect();
+    tcp_release(false);
+
     string line;
     while (true) {
         cout << "> ";
@@ -173,14 +215,6 @@ string UserClient::send_udp_request(const string& msg) {
         return "";
     }
 
-    // Set receive timeout for robustness
-    struct timeval tv;
-    tv.tv_sec = 5;   // 5 seconds timeout
-    tv.tv_usec = 0;
-    if (::setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-        cerr << "[user] setsockopt timeout failed\n";
-    }
-
     addrinfo hints{}, *res = nullptr;
     hints.ai_family   = AF_INET;
     hints.ai_socktype = SOCK_DGRAM;
@@ -193,44 +227,56 @@ string UserClient::send_udp_request(const string& msg) {
         return "";
     }
 
-    // Send request
-    ssize_t n = ::sendto(sockfd, msg.c_str(), msg.size(), 0,
-                         res->ai_addr, res->ai_addrlen);
-    if (n < 0) {
-        cerr << "[user] sendto failed\n";
-        ::freeaddrinfo(res);
-        ::close(sockfd);
-        return "";
-    }
+    // Binary frame if the server takes them and msg has a binary form
+    string wire;
+    if (!binary_ || !protocol::encode_binary(msg, wire)) wire = msg;
 
-    // Receive response
-    char buffer[1024];
-    sockaddr_storage src_addr{};
-    socklen_t src_len = sizeof(src_addr);
-    n = ::recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0,
-                   reinterpret_cast<sockaddr*>(&src_addr), &src_len);
+    // Send, and resend with backoff until a reply arrives. The request
+    // ID makes a resent request safe: the server answers it from cache.
+    char    buffer[1024];
+    ssize_t n    = -1;
+    int     wait = UDP_FIRST_WAIT_MS;
+    for (int attempt = 0; attempt < UDP_ATTEMPTS && n <= 0; ++attempt, wait *= 2) {
+        if (::sendto(sockfd, wire.data(), wire.size(), 0,
+                     res->ai_addr, res->ai_addrlen) < 0) {
+            cerr << "[user] sendto failed\n";
+            break;
+        }
+        pollfd pfd{sockfd, POLLIN, 0};
+        if (::poll(&pfd, 1, wait) > 0) {
+            n = ::recv(sockfd, buffer, sizeof(buffer) - 1, 0);
+        }
+    }
     if (n <= 0) {
-        cerr << "[user] recvfrom failed or empty datagram\n";
+        cerr << "[user] no reply from server\n";
         ::freeaddrinfo(res);
         ::close(sockfd);
         return "";
     }
-    buffer[n] = '\0';
-
     ::freeaddrinfo(res);
     ::close(sockfd);
 
-    return string(buffer);
+    return reply_text(string(buffer, static_cast<size_t>(n)));
 }
 
 // ---------- TCP helper ----------
 
-// Send TCP request and read one line response
-string UserClient::send_tcp_request(const string& msg) {
+// Connection for the next TCP request. A kept-alive connection is
+// reused unless the server has closed it meanwhile; a new one asks for
+// keep-alive, and a server that answers ERR gets one connection per
+// request from then on.
+int UserClient::tcp_connect() {
+    if (tcp_fd_ >= 0) {
+        pollfd pfd{tcp_fd_, POLLIN, 0};
+        if (::poll(&pfd, 1, 0) == 0) return tcp_fd_;
+        ::close(tcp_fd_); // EOF (or stray bytes): start over
+        tcp_fd_ = -1;
+    }
+
     int sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
         cerr << "[user] TCP socket() failed\n";
-        return "";
+        return -1;
     }
 
     addrinfo hints{}, *res = nullptr;
@@ -242,7 +288,7 @@ string UserClient::send_tcp_request(const string& msg) {
     if (err != 0) {
         cerr << "[user] getaddrinfo (TCP): " << gai_strerror(err) << "\n";
         ::close(sockfd);
-        return "";
+        return -1;
     }
 
     // Connect to server
@@ -250,25 +296,103 @@ string UserClient::send_tcp_request(const string& msg) {
         cerr << "[user] connect (TCP) failed\n";
         ::freeaddrinfo(res);
         ::close(sockfd);
-        return "";
+        return -1;
     }
 
     ::freeaddrinfo(res);
 
-    // Send request
-    ssize_t n = ::write(sockfd, msg.c_str(), msg.size());
-    if (n < 0) {
+    if (tcp_keep_alive_) {
+        string kal = protocol::build_keep_alive();
+        if (!write_all(sockfd, kal.data(), kal.size())) {
+            cerr << "[user] write (TCP) failed\n";
+            ::close(sockfd);
+            return -1;
+        }
+        string line = tcp_read_line(sockfd);
+        auto r = protocol::parse_reply(line);
+        if (r.type != "RKA" || r.status != "OK") {
+            ::close(sockfd);
+            if (r.type != "ERR") {
+                cerr << "[user] no reply from server (TCP)\n";
+                return -1;
+            }
+            tcp_keep_alive_ = false;
+            return tcp_connect();
+        }
+        binary_ = r.rest == "BIN";
+    }
+
+    tcp_fd_ = sockfd;
+    return sockfd;
+}
+
+// Done with the current request: keep the connection only if the
+// exchange completed and the server keeps it alive
+void UserClient::tcp_release(bool failed) {
+    if (tcp_fd_ >= 0 && (failed || !tcp_keep_alive_)) {
+        ::close(tcp_fd_);
+        tcp_fd_ = -1;
+    }
+}
+
+// Send TCP request and read one line response
+string UserClient::send_tcp_request(const string& msg,
+                                    const char* body, size_t body_len) {
+    int sockfd = tcp_connect();
+    if (sockfd < 0) return "";
+
+    // Send request (binary frame if the server takes them)
+    string wire;
+    if (!binary_ || !protocol::encode_binary(msg, wire)) wire = msg;
+    if (!write_all(sockfd, wire.data(), wire.size()) ||
+        !write_all(sockfd, body, body_len)) {
         cerr << "[user] write (TCP) failed\n";
-        ::close(sockfd);
+        tcp_release(true);
         return "";
     }
 
-    // Read response
-    string line = tcp_read_line(sockfd);
+    // Read response (a list reply can be long, so read in chunks; only
+    // this reply is outstanding, so nothing past its end arrives)
+    string reply;
+    char   buf[65536];
+    while (!reply_complete(reply)) {
+        ssize_t n = ::read(sockfd, buf, sizeof(buf));
+        if (n <= 0) break;
+        reply.append(buf, n);
+    }
 
-    ::close(sockfd);
+    bool complete = reply_complete(reply);
+    tcp_release(!complete);
+    return complete ? reply_text(reply) : "";
+}
 
-    return line;
+// Fetch the whole myevents/myreservations list. A paged UDP reply ends in
+// "@<cursor>", which is sent back for the next page; a "TCP" status means
+// the list is too long for UDP and is fetched over TCP instead. Returns
+// one reply line, as if the list had arrived in a single datagram.
+string UserClient::request_list(bool reservations) {
+    auto build = reservations ? protocol::build_myreservations
+                              : protocol::build_myevents;
+    string items, cursor;
+    while (true) {
+        string reply = send_udp_request(
+            build(currentUid_, currentPass_, next_request_id(), cursor));
+        if (reply.empty()) return "";
+
+        auto r = protocol::parse_reply(reply);
+        if (r.status == "TCP" && cursor.empty()) {
+            return send_tcp_request(build(currentUid_, currentPass_, 0, ""));
+        }
+        if (r.status != "OK") return reply;
+
+        size_t at = r.rest.rfind('@');
+        items += ' ';
+        items += r.rest.substr(0, at);
+        if (at == string_view::npos) {
+            return string(r.type) + " OK" + items + "\n";
+        }
+        cursor = r.rest.substr(at + 1);
+    }
 }
 
 // ---------- Commands: login/logout/unregister/mye/myr ----------
@@ -281,7 +405,7 @@ void UserClient::cmd_login(const string& uid, const string& pass) {
     }
 
     // Send login request via UDP
-    string msg = protocol::build_login(uid, pass);
+    string msg = protocol::build_login(uid, pass, next_request_id());
     string reply = send_udp_request(msg);
     if (reply.empty()) {
         cout << "No reply from server.\n";
@@ -289,7 +413,7 @@ void UserClient::cmd_login(const string& uid, const string& pass) {
     }
 
     // Parse response
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error: server replied ERR.\n";
@@ -328,14 +452,14 @@ void UserClient::cmd_logout() {
         return;
     }
 
-    string msg = protocol::build_logout(currentUid_, currentPass_);
+    string msg = protocol::build_logout(currentUid_, currentPass_, next_request_id());
     string reply = send_udp_request(msg);
     if (reply.empty()) {
         cout << "No reply from server.\n";
         return;
     }
 
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error: server replied ERR.\n";
@@ -375,14 +499,14 @@ void UserClient::cmd_unregister() {
         return;
     }
 
-    string msg = protocol::build_unregister(currentUid_, currentPass_);
+    string msg = protocol::build_unregister(currentUid_, currentPass_, next_request_id());
     string reply = send_udp_request(msg);
     if (reply.empty()) {
         cout << "No reply from server.\n";
         return;
     }
 
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error: server replied ERR.\n";
@@ -424,14 +548,13 @@ void UserClient::cmd_myevents() {
         return;
     }
 
-    string msg = protocol::build_myevents(currentUid_, currentPass_);
-    string reply = send_udp_request(msg);
+    string reply = request_list(false);
     if (reply.empty()) {
         cout << "No reply from server.\n";
         return;
     }
 
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error: server replied ERR.\n";
@@ -444,18 +567,17 @@ void UserClient::cmd_myevents() {
     }
 
     if (r.status == "OK") {
-        istringstream iss(r.rest);
         struct MyEv {
             string eid;
             string status;
         };
         vector<MyEv> myevents;
-        string eid, st;
+        string_view rec[2]; // EID, state
 
-        while (iss >> eid >> st) {
+        while (r.next(rec)) {
             MyEv e;
-            e.eid = eid;
-            e.status = state_to_status(st);
+            e.eid = string(rec[0]);
+            e.status = state_to_status(string(rec[1]));
             myevents.push_back(e);
         }
 
@@ -499,15 +621,14 @@ void UserClient::cmd_myreservations() {
         return;
     }
 
-    string msg   = protocol::build_myreservations(currentUid_, currentPass_);
-    string reply = send_udp_request(msg);
+    string reply = request_list(true);
 
     if (reply.empty()) {
         cout << "No reply from server.\n";
         return;
     }
 
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error: server replied ERR.\n";
@@ -535,27 +656,26 @@ void UserClient::cmd_myreservations() {
         return;
     }
 
-    istringstream iss(r.rest);
-
     cout << "My reservations: \n (Event EID | Date | Reserved Seats)\n";
 
     int num_reservations = 0;
 
     while (true) {
-        string eid, date, time, seatsStr;
-        if (!(iss >> eid >> date >> time >> seatsStr)) {
+        string_view rec[4]; // EID, date, time, seats
+        if (!r.next(rec)) {
             // No more complete groups of 4 tokens
             break;
         }
+        string_view eid = rec[0], date = rec[1], time = rec[2];
 
         int seats = 0;
         try {
-            seats = stoi(seatsStr);
+            seats = stoi(string(rec[3]));
         } catch (...) {
             break;
         }
 
-        string time_short = time.substr(0, 5);
+        string_view time_short = time.substr(0, 5);
         cout << "  " << eid << " | " << date << " | " << time_short
               << " | " << seats << "\n";
         ++num_reservations;
@@ -581,7 +701,7 @@ void UserClient::cmd_changePass(const string& oldPass, const string& newPass) {
         return;
     }
 
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error (TCP): server replied ERR.\n";
@@ -677,72 +797,21 @@ void UserClient::cmd_create(const string& name,
         return;
     }
 
-    // Build request header
+    // Build request header (the server stores the name without its path)
     string header = protocol::build_create_header(
         currentUid_, currentPass_, name,
         date, time,
-        attendees, fname, fsize);
-
-    // Connect to server
-    int sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        cerr << "[user] TCP socket() failed\n";
-        return;
-    }
-
-    addrinfo hints{}, *res = nullptr;
-    hints.ai_family   = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-
-    string portStr = to_string(serverPort_);
-    int err = ::getaddrinfo(serverIp_.c_str(), portStr.c_str(), &hints, &res);
-    if (err != 0) {
-        cerr << "[user] getaddrinfo (TCP): " << gai_strerror(err) << "\n";
-        ::close(sockfd);
-        return;
-    }
-
-    if (::connect(sockfd, res->ai_addr, res->ai_addrlen) < 0) {
-        cerr << "[user] connect (TCP) failed\n";
-        ::freeaddrinfo(res);
-        ::close(sockfd);
-        return;
-    }
+        attendees, fname.substr(fname.rfind('/') + 1), fsize);
 
-    ::freeaddrinfo(res);
-
-    // Send header
-    ssize_t n = ::write(sockfd, header.c_str(), header.size());
-    if (n < 0) {
-        cerr << "[user] write (TCP header) failed\n";
-        ::close(sockfd);
-        return;
-    }
-
-    // Send file data
-    size_t remaining = data.size();
-    const char* ptr = data.data();
-    while (remaining > 0) {
-        ssize_t sent = ::write(sockfd, ptr, remaining);
-        if (sent <= 0) {
-            cerr << "[user] write (TCP file data) failed\n";
-            ::close(sockfd);
-            return;
-        }
-        remaining -= static_cast<size_t>(sent);
-        ptr += sent;
-    }
-
-    string reply = tcp_read_line(sockfd);
-
-    ::close(sockfd);
+    // Send header and file data
+    string reply = send_tcp_request(header, data.data(), data.size());
 
     if (reply.empty()) {
         cout << "No reply from server (TCP).\n";
         return;
     }
 
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error (TCP): server replied ERR.\n";
@@ -755,7 +824,7 @@ void UserClient::cmd_create(const string& name,
     }
 
     if (r.status == "OK") {
-        string eid = r.rest;
+        string eid(r.rest);
         if (!eid.empty() && eid[0] == ' ') {
             eid.erase(0, 1);
         }
@@ -786,7 +855,7 @@ void UserClient::cmd_list() {
         return;
     }
 
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error (TCP): server replied ERR.\n";
@@ -807,15 +876,14 @@ void UserClient::cmd_list() {
         };
         vector<EvInfo> events;
 
-        istringstream iss(r.rest);
-        string eid, name, st, date, time;
+        string_view rec[5]; // EID, name, state, date, time
 
-        while (iss >> eid >> name >> st >> date >> time) {
+        while (r.next(rec)) {
             EvInfo e;
-            e.eid      = eid;
-            e.name     = name;
-            e.status   = state_to_status(st);
-            e.datetime = date + " " + time;
+            e.eid      = string(rec[0]);
+            e.name     = string(rec[1]);
+            e.status   = state_to_status(string(rec[2]));
+            e.datetime = string(rec[3]) + " " + string(rec[4]);
             events.push_back(e);
         }
 
@@ -858,7 +926,7 @@ void UserClient::cmd_close(const string& eid) {
         return;
     }
 
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error (TCP): server replied ERR.\n";
@@ -931,7 +999,7 @@ void UserClient::cmd_reserve(const string& eid,
         return;
     }
 
-    auto r = protocol::parse_response_line(reply);
+    auto r = protocol::parse_reply(reply);
 
     if (r.type == "ERR") {
         cout << "Protocol error (TCP): server replied ERR.\n";
@@ -947,7 +1015,7 @@ void UserClient::cmd_reserve(const string& eid,
         cout << "Reservation accepted for event " << eid
                   << " (" << seats << " seat(s)).\n";
     } else if (r.status == "REJ") {
-        string remaining_str = r.rest;
+        string remaining_str(r.rest);
         if (!remaining_str.empty() && remaining_str[0] == ' ')
             remaining_str.erase(0, 1);
         cout << "Reservation rejected: only " << remaining_str
@@ -981,46 +1049,56 @@ void UserClient::cmd_show(const string& eid) {
         return;
     }
 
-    // --- Open TCP connection to ES ---
-    int sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    // --- Send SED request to ES ---
+    int sockfd = tcp_connect();
     if (sockfd < 0) {
-        cerr << "[user] TCP socket() failed\n";
+        cout << "Show failed: could not connect to server.\n";
         return;
     }
 
-    addrinfo hints{}, *res = nullptr;
-    hints.ai_family   = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-
-    string portStr = to_string(serverPort_);
-    int err = ::getaddrinfo(serverIp_.c_str(), portStr.c_str(), &hints, &res);
-    if (err != 0) {
-        cerr << "[user] getaddrinfo (TCP): " << gai_strerror(err) << "\n";
-        ::close(sockfd);
-        return;
-    }
-
-    if (::connect(sockfd, res->ai_addr, res->ai_addrlen) < 0) {
-        cerr << "[user] connect (TCP) failed\n";
-        ::freeaddrinfo(res);
-        ::close(sockfd);
-        return;
-    }
-
-    ::freeaddrinfo(res);
-
-    // --- Send SED request to ES ---
     string header = protocol::build_show(eid);
-
-    ssize_t n = ::write(sockfd, header.c_str(), header.size());
-    if (n < 0) {
+    string wire;
+    if (!binary_ || !protocol::encode_binary(header, wire)) wire = header;
+    if (!write_all(sockfd, wire.data(), wire.size())) {
         cerr << "[user] write (TCP SED) failed\n";
-        ::close(sockfd);
-        return;
+        tcp_release(true);
+        return;
+    }
+
+    // A binary reply header is read as one frame and its text form
+    // tokenized; a text header is read from the socket token by token
+    string head;
+    size_t head_pos = 0;
+    char   first    = 0;
+    if (::recv(sockfd, &first, 1, MSG_PEEK) == 1 &&
+        static_cast<uint8_t>(first) == protocol::BINARY_MAGIC) {
+        string frame(protocol::FRAME_HEADER, '\0');
+        bool ok = read_exact(sockfd, &frame[0], frame.size());
+        size_t size = ok ? protocol::frame_size(frame.data(), frame.size()) : 0;
+        ok = ok && size <= 4096;
+        if (ok) {
+            frame.resize(size);
+            ok = read_exact(sockfd, &frame[protocol::FRAME_HEADER],
+                            size - protocol::FRAME_HEADER) &&
+                 protocol::decode_binary(frame, head);
+        }
+        if (!ok) {
+            cout << "Show failed: could not read server reply header.\n";
+            tcp_release(true);
+            return;
+        }
     }
 
     auto read_token = [&](string &tok) -> bool {
         tok.clear();
+        if (!head.empty()) {
+            while (head_pos < head.size() &&
+                   isspace(static_cast<unsigned char>(head[head_pos]))) ++head_pos;
+            while (head_pos < head.size() &&
+                   !isspace(static_cast<unsigned char>(head[head_pos])))
+                tok.push_back(head[head_pos++]);
+            return !tok.empty();
+        }
         char c;
         while (true) {
             ssize_t r = ::read(sockfd, &c, 1);
@@ -1049,25 +1127,25 @@ void UserClient::cmd_show(const string& eid) {
 
     if (!read_token(type) || !read_token(status)) {
         cout << "Show failed: could not read server reply header.\n";
-        ::close(sockfd);
+        tcp_release(true);
         return;
     }
 
     if (type != "RSE") {
         cout << "Protocol error: expected RSE, got '" << type << "'.\n";
-        ::close(sockfd);
+        tcp_release(true);
         return;
     }
 
     if (status == "NOK") {
         cout << "Show failed: event does not exist or no file to send (NOK).\n";
-        ::close(sockfd);
+        tcp_release(true);
         return;
     }
 
     if (status != "OK") {
         cout << "Show failed: unexpected status '" << status << "'.\n";
-        ::close(sockfd);
+        tcp_release(true);
         return;
     }
 
@@ -1083,7 +1161,7 @@ void UserClient::cmd_show(const string& eid) {
         !read_token(fname)     ||
         !read_token(fsizeStr)) {
         cout << "Show failed: incomplete RSE header from server.\n";
-        ::close(sockfd);
+        tcp_release(true);
         return;
     }
 
@@ -1096,7 +1174,7 @@ void UserClient::cmd_show(const string& eid) {
 
     if (fsize <= 0) {
         cout << "Show failed: invalid file size in server reply.\n";
-        ::close(sockfd);
+        tcp_release(true);
         return;
     }
 
@@ -1116,15 +1194,16 @@ void UserClient::cmd_show(const string& eid) {
                              static_cast<size_t>(remaining));
         if (got <= 0) {
             cout << "Show failed: could not read all file data from server.\n";
-            ::close(sockfd);
+            tcp_release(true);
             return;
         }
         remaining -= got;
         offset    += static_cast<size_t>(got);
     }
 
-    ::close(sockfd);
-
+    // A text reply ends with a newline after the data
+    char nl = '\n';
+    tcp_release(head.empty() && (::read(sockfd, &nl, 1) != 1 || nl != '\n'));
 
     FILE *fp = fopen(fname.c_str(), "wb");
     if (!fp) {
@@ -0,0 +1,211 @@
+using namespace ::std;
+
+#include "wal.hpp"
+#include "common.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+WriteAheadLog::WriteAheadLog(string dir) : dir_(move(dir)) {}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+string WriteAheadLog::segment_path(uint64_t seq) const {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/wal-%06llu.log",
+             static_cast<unsigned long long>(seq));
+    return dir_ + buf;
+}
+
+// List wal-NNNNNN.log files in the data directory
+vector<uint64_t> WriteAheadLog::segments() const {
+    vector<uint64_t> segs;
+    DIR* d = ::opendir(dir_.c_str());
+    if (!d) return segs;
+
+    while (dirent* de = ::readdir(d)) {
+        unsigned long long seq = 0;
+        int consumed = 0;
+        if (sscanf(de->d_name, "wal-%llu.log%n", &seq, &consumed) == 1 &&
+            de->d_name[consumed] == '\0') {
+            segs.push_back(seq);
+        }
+    }
+    ::closedir(d);
+    sort(segs.begin(), segs.end());
+    return segs;
+}
+
+void WriteAheadLog::replay(uint64_t first,
+                           const function<void(const WalRecord&)>& apply) const {
+    for (uint64_t seq : segments()) {
+        if (seq < first) continue;
+
+        ifstream ifs(segment_path(seq), ios::binary);
+        string data((istreambuf_iterator<char>(ifs)),
+                    istreambuf_iterator<char>());
+
+        size_t pos = 0;
+        while (true) {
+            size_t nl = data.find('\n', pos);
+            if (nl == string::npos) break; // torn or empty tail
+
+            istringstream iss(data.substr(pos, nl - pos));
+            pos = nl + 1;
+
+            string tag;
+            if (!(iss >> tag) || tag.size() != 1) continue;
+            WalRecord rec{static_cast<WalOp>(tag[0]), {}};
+            string field;
+            while (iss >> field) rec.fields.push_back(move(field));
+            apply(rec);
+        }
+    }
+}
+
+bool WriteAheadLog::open_segment(uint64_t seq) {
+    int fd = ::open(segment_path(seq).c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("open WAL segment");
+        return false;
+    }
+    // The new entry must outlive a crash once records synced into it do
+    if (!sync_dir(dir_)) perror("sync WAL directory");
+
+    lock_guard<mutex> lk(mtx_);
+    if (fd_ >= 0) {
+        // Records in the old segment must not lag behind the new one
+        if (::fdatasync(fd_) == 0) {
+            mark_durable(lsn_);
+        } else {
+            perror("fdatasync WAL");
+        }
+        ::close(fd_);
+    }
+    fd_   = fd;
+    seq_  = seq;
+    size_ = 0;
+    return true;
+}
+
+// Encode as "<tag> <field>...\n" and write it with a single append
+bool WriteAheadLog::append(const WalRecord& rec, uint64_t& lsn, size_t& size) {
+    string line(1, static_cast<char>(rec.op));
+    for (const auto& f : rec.fields) {
+        line += ' ';
+        line += f;
+    }
+    line += '\n';
+
+    lock_guard<mutex> lk(mtx_);
+    if (fd_ < 0) {
+        fputs("[WAL] no open segment; record not logged\n", stderr);
+        return false;
+    }
+    size_t off = 0;
+    while (off < line.size()) {
+        ssize_t n = ::write(fd_, line.data() + off, line.size() - off);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            perror("write WAL");
+            break;
+        }
+        off += static_cast<size_t>(n);
+    }
+    if (off != line.size()) {
+        // Drop a partial line so the next record starts on a line of its own
+        if (off > 0 && ::ftruncate(fd_, static_cast<off_t>(size_)) != 0) {
+            perror("truncate WAL");
+        }
+        return false;
+    }
+    size_ += off;
+    lsn  = ++lsn_;
+    size = size_;
+    return true;
+}
+
+uint64_t WriteAheadLog::sync() {
+    lock_guard<mutex> sl(sync_mtx_);
+    int      fd;
+    uint64_t upto;
+    {
+        lock_guard<mutex> lk(mtx_);
+        if (fd_ < 0 || lsn_ <= durable_.load()) return durable_.load();
+        fd   = ::dup(fd_); // appends (and rotations) go on meanwhile
+        upto = lsn_;
+    }
+    if (fd < 0) {
+        perror("dup WAL");
+        return durable_.load();
+    }
+    if (::fdatasync(fd) == 0) {
+        mark_durable(upto);
+    } else {
+        perror("fdatasync WAL");
+    }
+    ::close(fd);
+    return durable_.load();
+}
+
+void WriteAheadLog::mark_durable(uint64_t lsn) {
+    uint64_t d = durable_.load();
+    while (d < lsn && !durable_.compare_exchange_weak(d, lsn)) {}
+}
+
+uint64_t WriteAheadLog::sync_to(uint64_t lsn) {
+    if (durable_.load() >= lsn) return durable_.load();
+    return sync(); // rechecks under sync_mtx_: a sync that just ran may cover it
+}
+
+uint64_t WriteAheadLog::appended() const {
+    lock_guard<mutex> lk(mtx_);
+    return lsn_;
+}
+
+uint64_t WriteAheadLog::rotate() {
+    uint64_t next;
+    {
+        lock_guard<mutex> lk(mtx_);
+        next = seq_ + 1;
+    }
+    return open_segment(next) ? next : 0;
+}
+
+uint64_t WriteAheadLog::current_segment() const {
+    lock_guard<mutex> lk(mtx_);
+    return seq_;
+}
+
+size_t WriteAheadLog::current_size() const {
+    lock_guard<mutex> lk(mtx_);
+    return size_;
+}
+
+void WriteAheadLog::remove_before(uint64_t seq) {
+    for (uint64_t s : segments()) {
+        if (s < seq) ::unlink(segment_path(s).c_str());
+    }
+}
+
+uint64_t WriteAheadLog::read_checkpoint() const {
+    ifstream ifs(dir_ + "/wal.checkpoint");
+    uint64_t seq = 0;
+    if (!(ifs >> seq)) return 0;
+    return seq;
+}
+
+bool WriteAheadLog::write_checkpoint(uint64_t seq) {
+    return write_file_atomic(dir_ + "/wal.checkpoint", to_string(seq) + "\n");
+}
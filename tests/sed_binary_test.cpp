@@ -0,0 +1,138 @@
+using namespace ::std;
+
+#include "protocol.hpp"
+#include "common.hpp"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Creates an event whose time has seconds (hh:mm:ss, accepted by the
+// server) over a binary connection, then shows it with binary SED: the
+// RSE header must come back as a frame, followed by exactly the file,
+// with no text terminator left in front of the next reply.
+
+static const char FILE_DATA[] = "flyer";
+
+static int failures = 0;
+
+static void check(bool ok, const string& what) {
+    if (!ok) {
+        cerr << "FAIL: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Text form of the next frame on fd, "" if none arrives
+static string read_frame(int fd) {
+    string frame(protocol::FRAME_HEADER, '\0');
+    if (!read_exact(fd, &frame[0], frame.size())) return "";
+    size_t size = protocol::frame_size(frame.data(), frame.size());
+    if (static_cast<uint8_t>(frame[0]) != protocol::BINARY_MAGIC || size > 4096) return "";
+    frame.resize(size);
+    string text;
+    if (!read_exact(fd, &frame[protocol::FRAME_HEADER], size - protocol::FRAME_HEADER) ||
+        !protocol::decode_binary(frame, text))
+        return "";
+    return text;
+}
+
+static bool send_frame(int fd, const string& text, const char* body = nullptr,
+                       size_t body_len = 0) {
+    string frame;
+    return protocol::encode_binary(text, frame) &&
+           write_all(fd, frame.data(), frame.size()) &&
+           write_all(fd, body, body_len);
+}
+
+static void run_checks(int port) {
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // Log in over UDP (registers the user)
+    int udp = ::socket(AF_INET, SOCK_DGRAM, 0);
+    string lin = protocol::build_login("100001", "password");
+    ::sendto(udp, lin.data(), lin.size(), 0,
+             reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    char    buf[256];
+    pollfd  upfd{udp, POLLIN, 0};
+    ssize_t n = ::poll(&upfd, 1, 2000) > 0 ? ::recv(udp, buf, sizeof(buf), 0) : -1;
+    check(n > 0 && string(buf, static_cast<size_t>(n)) == "RLI REG\n", "login");
+    ::close(udp);
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        check(false, "connect");
+        return;
+    }
+    string kal = protocol::build_keep_alive();
+    write_all(fd, kal.data(), kal.size());
+    string line(11, '\0');
+    check(read_exact(fd, &line[0], line.size()) && line == "RKA OK BIN\n", "KAL");
+
+    string cre = protocol::build_create_header("100001", "password", "party",
+                                               "01-01-2099", "10:00:00", 100,
+                                               "fly.txt", sizeof(FILE_DATA) - 1);
+    check(send_frame(fd, cre, FILE_DATA, sizeof(FILE_DATA) - 1), "encode CRE");
+    check(read_frame(fd) == "RCE OK 001\n", "create");
+
+    // Twice: a stray terminator after the first file would break the second
+    for (int round = 0; round < 2; ++round) {
+        check(send_frame(fd, protocol::build_show("001")), "encode SED");
+        string head = read_frame(fd);
+        check(head == "RSE OK 100001 party 01-01-2099 10:00:00 100 0 fly.txt 5 ",
+              "RSE header frame: '" + head + "'");
+        string data(sizeof(FILE_DATA) - 1, '\0');
+        check(read_exact(fd, &data[0], data.size()) && data == FILE_DATA, "file data");
+    }
+
+    // Nothing may follow the second file
+    pollfd tpfd{fd, POLLIN, 0};
+    check(::poll(&tpfd, 1, 200) == 0, "no bytes after the file");
+    ::close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        cerr << "Usage: " << argv[0] << " <path to ES>\n";
+        return 2;
+    }
+    char* es = ::realpath(argv[1], nullptr);
+    char dir[] = "/tmp/es-test-XXXXXX";
+    if (!es || !::mkdtemp(dir)) {
+        perror("setup");
+        return 2;
+    }
+    int port = 40000 + ::getpid() % 20000;
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        if (::chdir(dir) != 0) _exit(127);
+        string p = to_string(port);
+        ::execl(es, es, "-p", p.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    ::usleep(300000); // let the server bind
+
+    run_checks(port);
+
+    ::kill(pid, SIGTERM);
+    ::waitpid(pid, nullptr, 0);
+    string rm = string("rm -rf ") + dir;
+    if (::system(rm.c_str()) != 0) cerr << "could not remove " << dir << "\n";
+    free(es);
+
+    cout << (failures ? "FAILED\n" : "PASSED\n");
+    return failures ? 1 : 0;
+}